@@ -1,3 +1,32 @@
+// Deterministic physics, define PHYSICS_DETERMINISTIC here or build with msbuild /p:PhysicsDeterministic=true (adds /fp:strict)
+/* The step gives bit for bit the same result on every machine, compiler and optimization setting, so lockstep replays
+   and regression runs only need the inputs instead of the full state every frame. Float math is exact as long as each
+   + - * / and sqrt is rounded on its own, what changes between builds is the compiler fusing a * b + c into one FMA,
+   x87 keeping extra precision, fast-math, and the C library's sin and cos. This turns contraction off for everything
+   below (raymath included), refuses builds that can't be made exact, swaps the SIMD kernels for the scalar loops so
+   every build runs the same code, and physicsSinCos replaces the library trig */
+//#define PHYSICS_DETERMINISTIC
+#if defined(PHYSICS_DETERMINISTIC)
+#include <cfloat>
+#if defined(__FAST_MATH__)
+#error "PHYSICS_DETERMINISTIC can't be built with fast-math, it reorders float operations"
+#endif
+#if defined(_M_FP_FAST)
+#error "PHYSICS_DETERMINISTIC can't be built with /fp:fast, it reorders float operations, use /fp:strict or /fp:precise"
+#endif
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD != 0
+#error "PHYSICS_DETERMINISTIC needs floats evaluated in float precision (SSE2), not x87"
+#endif
+#if defined(_MSC_VER) && !defined(__clang__)
+#pragma float_control(precise, on)
+#pragma fp_contract(off)
+#elif defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+#endif
+
 #include "raylib.h"
 #include "raymath.h"
 #define RAYGUI_IMPLEMENTATION
@@ -5,9 +34,71 @@
 #include "game.h"
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdio>
+
+// Checkpoints are written by a forked child on Linux, copy on write gives it a frozen copy of the world for free
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/wait.h>
+#define PHYSICS_FORK_CHECKPOINTS
+#endif
+
+// SIMD kernels (narrowphase, integrate), picked at compile time from the instruction sets the compiler is allowed to use
+// Deterministic builds always take the scalar loops, so an AVX2 build and an SSE2 build can't end up on different code
+#if defined(PHYSICS_DETERMINISTIC)
+#define NARROWPHASE_LANES 1
+#define NARROWPHASE_SIMD_NAME "deterministic"
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define PHYSICS_SIMD_AVX2
+#define NARROWPHASE_LANES 8
+#define NARROWPHASE_SIMD_NAME "AVX2"
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PHYSICS_SIMD_SSE2
+#define NARROWPHASE_LANES 4
+#define NARROWPHASE_SIMD_NAME "SSE2"
+#else
+#define NARROWPHASE_LANES 1
+#define NARROWPHASE_SIMD_NAME "no SIMD"
+#endif
 
 using namespace std;
 
+// Sine and cosine of an angle in radians, for anything that feeds into the simulation (halfspace normals, launch velocity)
+/* Deterministic builds use a polynomial instead of the C library, which rounds the last bit differently from one
+   platform to the next. The angle is brought into [-pi/4, pi/4] by taking off whole quarter turns, with pi/2 split in
+   two parts so the remainder keeps its precision, then Taylor series good to about one float ulp on that range */
+void physicsSinCos(float radians, float* sine, float* cosine)
+{
+#if defined(PHYSICS_DETERMINISTIC)
+	float quarterTurns = roundf(radians * (2.0f / PI));
+	float r = (radians - quarterTurns * 1.5703125f) - quarterTurns * 4.83826794897e-4f;
+	float r2 = r * r;
+	float s = r + r * r2 * (-1.0f / 6.0f + r2 * (1.0f / 120.0f + r2 * (-1.0f / 5040.0f + r2 * (1.0f / 362880.0f))));
+	float c = 1.0f + r2 * (-0.5f + r2 * (1.0f / 24.0f + r2 * (-1.0f / 720.0f + r2 * (1.0f / 40320.0f + r2 * (-1.0f / 3628800.0f)))));
+	switch ((int)quarterTurns & 3) // & 3 also works for negative turns, -1 & 3 is 3
+	{
+	case 0: *sine = s; *cosine = c; break;
+	case 1: *sine = c; *cosine = -s; break;
+	case 2: *sine = -s; *cosine = -c; break;
+	default: *sine = -c; *cosine = s; break;
+	}
+#else
+	*sine = sinf(radians);
+	*cosine = cosf(radians);
+#endif
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 //    ________          _____             .__   __   
@@ -19,8 +110,17 @@ using namespace std;
 
 // Frame rate and time variables
 const unsigned int TARGET_FPS = 60;
-float time;
-float dt;
+float simTime; // Seconds simulated so far, not called time so it doesn't clash with time() from <ctime>
+float dt; // Length of one physics step, always 1 / physicsRate
+
+// Fixed timestep, physics runs at its own rate no matter how long a frame takes to render
+float physicsRate = 60; // Physics steps per second
+int maxStepsPerFrame = 8; // Most steps one frame may run to catch up, past that the simulation slows down instead of falling further behind
+float accumulator = 0; // Real time that hasn't been simulated yet
+float alpha = 0; // Fraction of a step left in the accumulator after update(), 0 to 1, for interpolating between the last two states
+int stepsThisFrame = 0;
+int stepCount = 0; // Steps simulated since the program started, restoring a snapshot doesn't reset it
+float stepMilliseconds = 0; // Wall clock time of the last physics step, to compare solvers on the same scene
 
 // User-controlled parameters
 float speed = 0;
@@ -30,6 +130,49 @@ float positionY = 200;
 float coefficientofFriction = 0.5f;
 float spawnMass = 1.0f;
 
+// Threads
+int workerThreads = -1; // Worker threads for the physics step, -1 uses every core but one, 0 runs everything on the main thread
+
+// Debug toggles
+bool drawBroadphaseTree = false; // T: draw the boxes of the broadphase tree
+
+// Snapshots
+vector<unsigned char> quickSnapshot; // F5 saves the world here, F9 goes back to it
+
+// Checkpoints, snapshots written to disk every so often during long runs, see checkpointWorld
+bool checkpointing = false; // Toggle with O
+bool resumeFromCheckpoint = true; // Start from the newest checkpoint that loads, if there is one, except in the capture modes (see main)
+float checkpointInterval = 10.0f; // Seconds of simulation between checkpoints
+const int CHECKPOINT_SLOTS = 3; // Files written in turn, so a crash while writing one still leaves the others
+const char* CHECKPOINT_DIRECTORY = "checkpoints";
+float nextCheckpoint = 0; // simTime the next checkpoint is due at
+int checkpointsWritten = 0;
+float checkpointMilliseconds = 0; // How long the simulation was held up by the last checkpoint
+#if defined(PHYSICS_FORK_CHECKPOINTS)
+pid_t checkpointWriter = 0; // Child still writing the last checkpoint, 0 if there isn't one
+#endif
+
+// Rewind, Z pauses and a timeline slider scrubs back through the last few seconds, see rewindBuffer
+bool rewindRecording = false; // Toggle with X, off by default since it copies the bodies every step
+bool rewinding = false;
+float rewindTime = 0; // simTime of the frame the timeline points at
+float shownRewindTime = 0; // simTime of the frame the world was last put back to
+
+// Sessions, recorded input played back as a repeatable benchmark, see startSession
+const char* recordFile = nullptr; // --record <file>: save this session's input as raylib automation events
+const char* replayFile = nullptr; // --replay <file>: play a recorded session back as fast as possible and report timings
+int sessionFrame = 0; // Frames since the program started, the same count raylib tags automation events with
+
+// Step hashes, a CRC32 of the body arrays after every step for finding where two runs stop agreeing, see hashStep
+bool logHashes = false; // H: log every step's hash
+const char* hashFile = nullptr; // --hashes <file>: write every step's hash to file
+const char* compareFile = nullptr; // --compare-hashes <file>: check every step against a file written by --hashes
+unsigned int stepHash = 0; // Hash after the last step, 0 while nothing wants hashes
+
+// State recordings, every step's bodies compressed on disk and played back without simulating, see stateRecorder
+const char* stateRecordFile = nullptr; // --record-states <file>
+const char* statePlayFile = nullptr; // --play-states <file>
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 //    __________.__                 .__         ________ ___.        __               __          
@@ -52,43 +195,275 @@ enum ObjectType
 	HALFSPACE
 };
 
+// Per body bit flags, stored in physicsBodies::flags
+enum BodyFlags
+{
+	BODY_STATIC = 1 << 0, // Object will not move or be affected by forces
+	BODY_CIRCLE = 1 << 1,
+	BODY_HALFSPACE = 1 << 2,
+	BODY_COLLIDED = 1 << 3, // Touched something this frame
+	BODY_EXTERNAL = 1 << 4, // Owned by the caller (globals like halfspace), the world never removes or frees it
+	BODY_ASLEEP = 1 << 5 // Resting, skipped by the step until something touches its island (see physicsWorld::updateSleep)
+};
+
+// Reference to a body that stays valid while other bodies are removed and slots move, see physicsWorld::getObject
+/* A raw physicObject* still points at the view after the body is removed, and a pooled view gets reused for the next
+   spawned circle. A handle names an entry in the world's handle table instead, the entry's generation goes up every time
+   its body is removed, so old handles stop matching rather than silently pointing at a different body */
+struct bodyHandle
+{
+	unsigned int slot = 0xFFFFFFFF; // Entry in physicsWorld's handle table
+	unsigned int generation = 0;
+
+	bool operator==(const bodyHandle& other) const { return slot == other.slot && generation == other.generation; }
+	bool operator!=(const bodyHandle& other) const { return !(*this == other); }
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+//           _           _       ___          _ _        
+//      _ __| |_ _  _ __(_)__ __| _ ) ___  __| (_)___ ___
+//     | '_ \ ' \ || (_-< / _(_-< _ \/ _ \/ _` | / -_|_-<
+//     | .__/_||_\_, /__/_\__/__/___/\___/\__,_|_\___/__/
+//     |_|       |__/                                    
+// Simulation data for every body in the world, stored as structure of arrays
+/* Every physics stage walks over all bodies but only touches a few fields, so instead of one struct per body
+   each field gets its own array. Body i is slot i in every array, a stage that only needs positions and velocities
+   streams through those arrays in order instead of jumping between heap objects.
+   Hot data is what the physics stages read every frame, cold data is only touched by drawing and a few responses */
+struct physicsBodies
+{
+	// Hot data
+	vector<float> positionX; // In pixels
+	vector<float> positionY;
+	vector<float> velocityX; // In pixels per second
+	vector<float> velocityY;
+	vector<float> forceX; // Net force, in Newtons (kg*m/s^2)
+	vector<float> forceY;
+	vector<float> inverseMass; // 1 / mass, 0 for static bodies so forces and pushes don't move them
+	vector<float> drag; // Linear drag coefficient, drag force = -drag * velocity
+	vector<float> radius; // 0 for shapes that aren't circles
+	vector<unsigned char> flags; // BodyFlags
+
+	// Cold data
+	vector<float> previousX; // Position at the start of the last step, drawing blends from here to position
+	vector<float> previousY;
+	vector<float> mass;
+	vector<float> grip; // Coefficient of friction for object
+	vector<unsigned int> id; // Stable id handed out by physicsWorld::addObject, labels use it so they don't change when bodies before it are removed
+	vector<Color> color;
+	vector<int> proxyId; // Leaf in the broadphase tree, -1 until the tree picks the body up
+	vector<unsigned int> handle; // Handle table entry pointing at this slot
+	vector<float> sleepTimer; // Seconds the body has been resting
+	vector<unsigned int> island; // Island the body went to sleep with, the whole island wakes together
+
+	int size() { return (int)flags.size(); }
+
+	// Append a body with default values, returns its slot
+	int add(unsigned char bodyFlags)
+	{
+		positionX.push_back(0);
+		positionY.push_back(0);
+		velocityX.push_back(0);
+		velocityY.push_back(0);
+		forceX.push_back(0);
+		forceY.push_back(0);
+		inverseMass.push_back((bodyFlags & BODY_STATIC) ? 0.0f : 1.0f);
+		radius.push_back(0);
+		flags.push_back(bodyFlags);
+		previousX.push_back(0);
+		previousY.push_back(0);
+		mass.push_back(1.0f);
+		drag.push_back(0.1f);
+		grip.push_back(0.5f);
+		id.push_back(0);
+		color.push_back(GREEN);
+		proxyId.push_back(-1);
+		handle.push_back(0);
+		sleepTimer.push_back(0);
+		island.push_back(0);
+		return size() - 1;
+	}
+
+	// Remove every slot with remove[i] set in one pass, kept bodies slide down but stay in the same order
+	void compact(const unsigned char* remove)
+	{
+		compactArray(positionX, remove);
+		compactArray(positionY, remove);
+		compactArray(velocityX, remove);
+		compactArray(velocityY, remove);
+		compactArray(forceX, remove);
+		compactArray(forceY, remove);
+		compactArray(inverseMass, remove);
+		compactArray(radius, remove);
+		compactArray(flags, remove);
+		compactArray(previousX, remove);
+		compactArray(previousY, remove);
+		compactArray(mass, remove);
+		compactArray(drag, remove);
+		compactArray(grip, remove);
+		compactArray(id, remove);
+		compactArray(color, remove);
+		compactArray(proxyId, remove);
+		compactArray(handle, remove);
+		compactArray(sleepTimer, remove);
+		compactArray(island, remove);
+	}
+
+	// Call visit on every array, in the order snapshots store them
+	template<typename Visit>
+	void forEachArray(Visit visit)
+	{
+		visit(positionX);
+		visit(positionY);
+		visit(velocityX);
+		visit(velocityY);
+		visit(forceX);
+		visit(forceY);
+		visit(inverseMass);
+		visit(drag);
+		visit(radius);
+		visit(flags);
+		visit(previousX);
+		visit(previousY);
+		visit(mass);
+		visit(grip);
+		visit(id);
+		visit(color);
+		visit(proxyId);
+		visit(handle);
+		visit(sleepTimer);
+		visit(island);
+	}
+
+	// CRC32 of every array but proxyId (which leaf a body got depends on the broadphase, not on the simulation)
+	// Arrays are copied into scratch back to back first, ComputeCRC32 can't carry on from an earlier result
+	unsigned int hash(vector<unsigned char>& scratch)
+	{
+		scratch.clear();
+		forEachArray([&](auto& values) {
+			if ((void*)&values == (void*)&proxyId) return;
+			const unsigned char* bytes = (const unsigned char*)values.data();
+			scratch.insert(scratch.end(), bytes, bytes + values.size() * sizeof(values[0]));
+		});
+		return ComputeCRC32(scratch.data(), (int)scratch.size());
+	}
+
+	template<typename T>
+	static void compactArray(vector<T>& values, const unsigned char* remove)
+	{
+		int kept = 0;
+		for (int i = 0; i < (int)values.size(); i++) {
+			if (remove[i]) continue;
+			if (kept != i) values[kept] = values[i];
+			kept++;
+		}
+		values.resize(kept);
+	}
+
+	// Static and sleeping bodies get an inverse mass of 0, so integrate() leaves them where they are
+	void updateInverseMass(int i) { inverseMass[i] = (flags[i] & (BODY_STATIC | BODY_ASLEEP)) ? 0.0f : 1.0f / mass[i]; }
+
+	void sleep(int i)
+	{
+		flags[i] |= BODY_ASLEEP;
+		velocityX[i] = 0;
+		velocityY[i] = 0;
+		updateInverseMass(i);
+	}
+
+	void wake(int i)
+	{
+		flags[i] &= ~BODY_ASLEEP;
+		sleepTimer[i] = 0;
+		updateInverseMass(i);
+	}
+
+	// True if neither body of the pair can move, one of them asleep and the other asleep or static
+	bool isResting(int a, int b)
+	{
+		const unsigned char resting = BODY_ASLEEP | BODY_STATIC;
+		return ((flags[a] | flags[b]) & BODY_ASLEEP) && (flags[a] & resting) && (flags[b] & resting);
+	}
+
+	Vector2 getPosition(int i) { return { positionX[i], positionY[i] }; }
+	void setPosition(int i, Vector2 position) { positionX[i] = position.x; positionY[i] = position.y; }
+	Vector2 getPreviousPosition(int i) { return { previousX[i], previousY[i] }; }
+	Vector2 getVelocity(int i) { return { velocityX[i], velocityY[i] }; }
+	void setVelocity(int i, Vector2 velocity) { velocityX[i] = velocity.x; velocityY[i] = velocity.y; }
+	Vector2 getForce(int i) { return { forceX[i], forceY[i] }; }
+	void addForce(int i, Vector2 force) { forceX[i] += force.x; forceY[i] += force.y; }
+};
+
 // Parent class for physics objects
+/* Objects don't hold any simulation data themselves, they are a view into one slot of physicsBodies
+   used by the drawing code and the GUI. physicsWorld::addObject binds the view to its slot */
 struct physicObject
 {
-	// Physic Object Variables
-	Vector2 position; // In pixels
-	Vector2 velocity; // In pixels per second
-	Vector2 netForce = { 0,0 }; // In Newtons (kg*m/s^2)
-	float mass = 1.0f;
-	float drag = 0.1f;
-	float grip = 0.5f; // Coefficient of friction for object
-	string name;
-	Color color;
-	bool isStatic = false; // If true, object will not move or be affected by forces
+	physicsBodies* bodies = nullptr; // Storage the object lives in
+	int index = -1; // Slot in the body arrays, changes when an object before it is removed
+	bodyHandle handle; // Stays the same for as long as the object is in the world, hold on to this instead of the pointer
+
+	// Functions | Setters and Getters
+	Vector2 getPosition() { return bodies->getPosition(index); }
+	void setPosition(Vector2 position) // Teleport, previous position moves too so drawing doesn't blend in from the old spot
+	{
+		if (isAsleep()) bodies->wake(index); // Moved by hand, its neighbours wake when it touches them
+		bodies->setPosition(index, position);
+		bodies->previousX[index] = position.x;
+		bodies->previousY[index] = position.y;
+	}
+	Vector2 getDrawPosition() { return Vector2Lerp(bodies->getPreviousPosition(index), getPosition(), alpha); } // Between the last two steps, see alpha
+	Vector2 getVelocity() { return bodies->getVelocity(index); }
+	void setVelocity(Vector2 velocity) { if (isAsleep()) bodies->wake(index); bodies->setVelocity(index, velocity); }
+	Vector2 getNetForce() { return bodies->getForce(index); }
+	float getMass() { return bodies->mass[index]; }
+	void setMass(float mass) { bodies->mass[index] = mass; bodies->updateInverseMass(index); }
+	float getDrag() { return bodies->drag[index]; }
+	void setDrag(float drag) { bodies->drag[index] = drag; }
+	float getGrip() { return bodies->grip[index]; }
+	void setGrip(float grip) { bodies->grip[index] = grip; }
+	Color getColor() { return bodies->color[index]; }
+	unsigned int getId() { return bodies->id[index]; }
+	const char* getName() { return TextFormat("%u", getId()); } // Label text, only built when a label is drawn
+	bool isStatic() { return (bodies->flags[index] & BODY_STATIC) != 0; }
+	bool isExternal() { return (bodies->flags[index] & BODY_EXTERNAL) != 0; }
+	bool isAsleep() { return (bodies->flags[index] & BODY_ASLEEP) != 0; }
+	void setStatic(bool isStatic) // Static objects get an inverse mass of 0, so nothing can push them
+	{
+		if (isStatic) bodies->flags[index] |= BODY_STATIC;
+		else bodies->flags[index] &= ~BODY_STATIC;
+		setMass(getMass());
+	}
 
 	// Functions
 	virtual void draw()  // Virtual Draw function |  Virtual keyword is required to allow this function to be overridden
 	{
-		DrawCircleV(position, 10, color);
-		DrawText(name.c_str(), position.x, position.y, 20, LIGHTGRAY);
-		DrawLineEx(position, position + velocity, 1, color);
+		Vector2 position = getDrawPosition();
+		DrawCircleV(position, 10, getColor());
+		DrawText(getName(), position.x, position.y, 20, LIGHTGRAY);
+		DrawLineEx(position, position + getVelocity(), 1, getColor());
 	}
 
 	virtual ObjectType Shape() = 0; // Pure virtual function to make PhysicObject an abstract class
 	//It is a declaration that has no definition, and it forces derived classes to provide an implementation for this function.
+
+	virtual ~physicObject() {}
 };
 
 // Circle class derived from PhysicObject
 class physicsCircle : public physicObject
 {
 public:
-	float radius; // radius of circle in pixels
+	float getRadius() { return bodies->radius[index]; } // radius of circle in pixels
+	void setRadius(float radius) { bodies->radius[index] = radius; }
 
 	void draw() override // Override the parent draw function
 	{
-		DrawCircleV(position, radius, color);
-		DrawText(name.c_str(), (int)position.x, (int)position.y, (int)(radius * 2), LIGHTGRAY);
-		DrawLineEx(position, position + velocity, 1, color);
+		Vector2 position = getDrawPosition();
+		float radius = getRadius();
+		DrawCircleV(position, radius, getColor());
+		DrawText(getName(), (int)position.x, (int)position.y, (int)(radius * 2), LIGHTGRAY);
+		DrawLineEx(position, position + getVelocity(), 1, getColor());
 	}
 
 	ObjectType Shape() override
@@ -108,318 +483,4046 @@ private:
 public:
 
 	// Functions | Setters and Getters
-	void setRotation(float degrees) { rotation = degrees; normal = Vector2Rotate({ 0,-1 }, rotation * DEG2RAD); } // Set rotation and update normal vector based on rotation
+	void setRotation(float degrees) // Set rotation and update normal vector based on rotation, { 0,-1 } rotated by degrees
+	{
+		rotation = degrees;
+		float sine, cosine;
+		physicsSinCos(rotation * DEG2RAD, &sine, &cosine);
+		normal = { sine, -cosine };
+	}
 	float getRotation() { return rotation; }
 	Vector2 getNormal() { return normal; }
 
-	void draw() override
+	void draw() override
+	{
+		Vector2 position = getDrawPosition();
+		DrawCircle(position.x, position.y, 8, RED); // Draw arbitrary line based on position and rotation
+		DrawLineEx(position, position + normal * 30, 1, RED); // Draw normal vector
+		Vector2 parrellelToSurface = Vector2Rotate(normal, PI * 0.5f);// Rotate function, takes radians. 360 degrees = 2PI radians
+		DrawLineEx(position - parrellelToSurface * 4000, position + parrellelToSurface * 4000, 1, RED); // Draw surface line
+	}
+
+	ObjectType Shape() override
+	{
+		return HALFSPACE;
+	}
+};
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//     __      __            .__       .___
+//    /  \    /  \___________|  |    __| _/
+//    \   \/\/   /  _ \_  __ \  |   / __ | 
+//     \        (  <_> )  | \/  |__/ /_/ | 
+//      \__/\  / \____/|__|  |____/\____ | 
+//           \/                         \/ 
+
+// Linker functions for collision responses, will be defined later on, just have the declarations here as a placeholder
+bool CircleCircleCollisionResponse(physicsBodies& bodies, int circleA, int circleB);
+struct cachedContact;
+bool CircleHalfspaceCollisionResponse(physicsBodies& bodies, int circle, physicsHalfspace* halfspace, cachedContact* contact = nullptr);
+
+// Which broadphase checkCollision uses to find the pairs that get sent to the collision responses
+enum BroadphaseMode
+{
+	BROADPHASE_BRUTE_FORCE, // Test every pair, O(n^2), kept as a reference to compare the others against
+	BROADPHASE_GRID,
+	BROADPHASE_TREE // Dynamic AABB tree, handles circles of very different sizes better than the grid
+};
+
+// How the pairs from the broadphase are tested
+enum NarrowphaseMode
+{
+	NARROWPHASE_SCALAR, // One pair at a time through the collision responses
+	NARROWPHASE_SIMD // Batches of circle pairs are rejected with CircleCircleOverlapMask first
+};
+
+// How contacts are resolved
+enum SolverMode
+{
+	SOLVER_POSITION, // Responses push overlapping bodies apart, halfspaces add a normal force worked out from gravity
+	SOLVER_IMPULSE, // Sequential impulses on the velocities, see physicsWorld::solveImpulses
+	SOLVER_SUBSTEP // Many short position based substeps instead of solver iterations, see physicsWorld::solveSubsteps
+};
+
+// Two bodies the broadphase thinks could be touching, a < b
+struct collisionPair
+{
+	int a;
+	int b;
+};
+
+// Contact between two bodies that is kept from one step to the next, see physicsWorld::refreshContacts
+/* Keyed by the handles of the bodies rather than their slots, since slots move when bodies are removed. The impulses are
+   what the response pushed with last step, a solver can start from them (warm starting) instead of from zero */
+struct cachedContact
+{
+	unsigned long long key; // Handle slots of both bodies, the lower one in the high bits
+	bodyHandle a, b; // a has the lower handle slot
+	float separation; // Distance between the surfaces at the start of the step, negative while overlapping
+	float normalImpulse; // Accumulated along the contact normal, in Newton seconds
+	float tangentImpulse; // Accumulated friction along the tangent
+	int age; // Steps in a row the contact has been cached
+	int pair; // Index into pairs this step, -1 for contacts kept while their bodies sleep
+};
+
+unsigned int CircleCircleOverlapMask(physicsBodies& bodies, const collisionPair* pairs);
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+//                    _   _      _  ___     _    _ 
+//      ____ __  __ _| |_(_)__ _| |/ __|_ _(_)__| |
+//     (_-< '_ \/ _` |  _| / _` | | (_ | '_| / _` |
+//     /__/ .__/\__,_|\__|_\__,_|_|\___|_| |_\__,_|
+//        |_|                                      
+// Uniform grid broadphase, bins circles by the cell their center falls in
+class spatialGrid
+{
+public:
+	float cellSize = 1.0f; // Width of one cell in pixels, recalculated from the largest circle on every build
+	unsigned int bucketMask = 0; // Bucket count is a power of two, so we can mask the hash instead of using %
+	vector<int> bucketStart; // Index of the first entry of each bucket, bucketStart[b + 1] is one past its last entry
+	vector<int> bucketFill; // Write cursor per bucket, only used while building
+	vector<int> entries; // Object indices sorted by bucket
+	vector<int> cellX; // Cell coordinates of every object, only valid for circles
+	vector<int> cellY;
+
+	// Hash cell coordinates into a bucket, the large primes spread neighbouring cells over the whole table
+	unsigned int hashCell(int x, int y)
+	{
+		return (((unsigned int)x * 73856093u) ^ ((unsigned int)y * 19349663u)) & bucketMask;
+	}
+
+	// Rebuild the grid from scratch, nearly every circle moves each frame so this is cheaper than updating it
+	void build(physicsBodies& bodies)
+	{
+		// Cell size = largest diameter, that way two overlapping circles are never more than one cell apart
+		// Plus half a diameter of slack, the responses push circles around while pairs are still being checked,
+		// without it the grid misses pairs that only start overlapping partway through checkCollision
+		float maxRadius = 1.0f;
+		unsigned int circleCount = 0;
+		for (int i = 0; i < bodies.size(); i++) {
+			if (!(bodies.flags[i] & BODY_CIRCLE)) continue;
+			if (bodies.radius[i] > maxRadius) maxRadius = bodies.radius[i];
+			circleCount++;
+		}
+		cellSize = maxRadius * 2 * 1.5f;
+
+		unsigned int bucketCount = 1;
+		while (bucketCount < circleCount * 2) bucketCount <<= 1; // Twice as many buckets as circles keeps hash collisions rare
+		bucketMask = bucketCount - 1;
+
+		// Counting sort: count the circles in each bucket, prefix sum the counts, then drop every circle into its slot
+		cellX.resize(bodies.size());
+		cellY.resize(bodies.size());
+		bucketStart.assign(bucketCount + 1, 0);
+		for (int i = 0; i < bodies.size(); i++) {
+			if (!(bodies.flags[i] & BODY_CIRCLE)) continue;
+			cellX[i] = (int)floorf(bodies.positionX[i] / cellSize);
+			cellY[i] = (int)floorf(bodies.positionY[i] / cellSize);
+			bucketStart[hashCell(cellX[i], cellY[i]) + 1]++;
+		}
+		for (unsigned int b = 0; b < bucketCount; b++) {
+			bucketStart[b + 1] += bucketStart[b];
+		}
+		bucketFill.assign(bucketStart.begin(), bucketStart.end() - 1);
+		entries.resize(circleCount);
+		for (int i = 0; i < bodies.size(); i++) {
+			if (!(bodies.flags[i] & BODY_CIRCLE)) continue;
+			entries[bucketFill[hashCell(cellX[i], cellY[i])]++] = i;
+		}
+	}
+
+	// Call callback(j) for every circle j in the 3x3 block of cells around circle i (including i itself)
+	template <typename Callback>
+	void forEachNeighbour(int i, Callback callback)
+	{
+		for (int dy = -1; dy <= 1; dy++) {
+			for (int dx = -1; dx <= 1; dx++) {
+				int x = cellX[i] + dx;
+				int y = cellY[i] + dy;
+				unsigned int bucket = hashCell(x, y);
+				for (int e = bucketStart[bucket]; e < bucketStart[bucket + 1]; e++) {
+					int j = entries[e];
+					if (cellX[j] == x && cellY[j] == y) callback(j); // Different cells can share a bucket, only keep the real neighbours
+				}
+			}
+		}
+	}
+
+	// Call callback(j) for every circle whose cell at build time touches the rectangle from low to high, expanded by one cell
+	// Returns false without calling anything if that's more than maxCells cells, the caller should fall back to checking everything
+	template <typename Callback>
+	bool forEachInRect(Vector2 low, Vector2 high, int maxCells, Callback callback)
+	{
+		int minX = (int)floorf(low.x / cellSize) - 1;
+		int minY = (int)floorf(low.y / cellSize) - 1;
+		int maxX = (int)floorf(high.x / cellSize) + 1;
+		int maxY = (int)floorf(high.y / cellSize) + 1;
+		if ((long long)(maxX - minX + 1) * (maxY - minY + 1) > maxCells) return false;
+		for (int y = minY; y <= maxY; y++) {
+			for (int x = minX; x <= maxX; x++) {
+				unsigned int bucket = hashCell(x, y);
+				for (int e = bucketStart[bucket]; e < bucketStart[bucket + 1]; e++) {
+					int j = entries[e];
+					if (cellX[j] == x && cellY[j] == y) callback(j);
+				}
+			}
+		}
+		return true;
+	}
+};
+
+// Axis aligned bounding box, min is the top left corner and max the bottom right
+struct AABB
+{
+	Vector2 min;
+	Vector2 max;
+};
+
+// Smallest box containing both a and b
+AABB AABBUnion(AABB a, AABB b)
+{
+	return { { fminf(a.min.x, b.min.x), fminf(a.min.y, b.min.y) }, { fmaxf(a.max.x, b.max.x), fmaxf(a.max.y, b.max.y) } };
+}
+
+bool AABBOverlap(AABB a, AABB b)
+{
+	return a.min.x <= b.max.x && b.min.x <= a.max.x && a.min.y <= b.max.y && b.min.y <= a.max.y;
+}
+
+bool AABBContains(AABB outer, AABB inner)
+{
+	return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && inner.max.x <= outer.max.x && inner.max.y <= outer.max.y;
+}
+
+// Perimeter is used as the cost of a box when deciding where to insert leaves, smaller boxes = fewer wasted overlap tests
+float AABBPerimeter(AABB box)
+{
+	return 2 * ((box.max.x - box.min.x) + (box.max.y - box.min.y));
+}
+
+// One node of the tree, leaves hold an object and branches always have exactly two children
+struct treeNode
+{
+	AABB box; // Fattened box for leaves, union of both children for branches
+	int parent = -1; // Also links the free list when the node isn't in use
+	int left = -1; // -1 on leaves
+	int right = -1;
+	int object = -1; // Slot in physicsBodies, leaves only
+	int height = 0; // 0 for leaves, -1 while on the free list
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+//         _                      _   _____            
+//      __| |_  _ _ _  __ _ _ __ (_)_|_   _| _ ___ ___ 
+//     / _` | || | ' \/ _` | '  \| / _|| || '_/ -_) -_)
+//     \__,_|\_, |_||_\__,_|_|_|_|_\__||_||_| \___\___|
+//           |__/                                      
+// Dynamic AABB tree broadphase, every circle gets a leaf with a fattened box that only has to be reinserted when the circle moves out of it
+class dynamicTree
+{
+public:
+	vector<treeNode> nodes; // Nodes are referenced by index, the vector can reallocate when it grows
+	int root = -1;
+	int freeList = -1; // First unused node, the rest are chained through parent
+	float margin = 5.0f; // How far in pixels the boxes are fattened on every side
+	float predictionScale = 2.0f; // Boxes are stretched by this many frames of movement in the direction the object is going
+
+	// Take a node off the free list, or grow the pool if it is empty
+	int allocateNode()
+	{
+		if (freeList == -1)
+		{
+			nodes.push_back(treeNode());
+			return (int)nodes.size() - 1;
+		}
+		int node = freeList;
+		freeList = nodes[node].parent;
+		nodes[node] = treeNode();
+		return node;
+	}
+
+	void freeNode(int node)
+	{
+		nodes[node].parent = freeList;
+		nodes[node].height = -1;
+		freeList = node;
+	}
+
+	bool isLeaf(int node) const { return nodes[node].left == -1; }
+
+	// Add an object to the tree, returns the proxy (leaf node) that has to be passed back to move or destroy it
+	int createProxy(AABB box, int object)
+	{
+		int proxy = allocateNode();
+		nodes[proxy].box = { { box.min.x - margin, box.min.y - margin }, { box.max.x + margin, box.max.y + margin } };
+		nodes[proxy].object = object;
+		insertLeaf(proxy);
+		return proxy;
+	}
+
+	void destroyProxy(int proxy)
+	{
+		removeLeaf(proxy);
+		freeNode(proxy);
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//                        ___                  
+	//      _ __  _____ _____| _ \_ _ _____ ___  _ 
+	//     | '  \/ _ \ V / -_)  _/ '_/ _ \ \ / || |
+	//     |_|_|_\___/\_/\___|_| |_| \___/_\_\\_, |
+	//                                        |__/ 
+	// Update a leaf after its object moved, only touches the tree if the object left its fattened box. Returns true if the leaf was reinserted
+	bool moveProxy(int proxy, AABB box, Vector2 displacement)
+	{
+		AABB fatBox = { { box.min.x - margin, box.min.y - margin }, { box.max.x + margin, box.max.y + margin } };
+		// Stretch the box ahead of the object, so a fast object doesn't have to be reinserted every single frame
+		Vector2 prediction = displacement * predictionScale;
+		if (prediction.x < 0) fatBox.min.x += prediction.x; else fatBox.max.x += prediction.x;
+		if (prediction.y < 0) fatBox.min.y += prediction.y; else fatBox.max.y += prediction.y;
+
+		AABB current = nodes[proxy].box;
+		if (AABBContains(current, box))
+		{
+			// Still inside, but if the box is far bigger than it needs to be (object slowed down) shrink it again
+			AABB hugeBox = { { fatBox.min.x - margin * 4, fatBox.min.y - margin * 4 }, { fatBox.max.x + margin * 4, fatBox.max.y + margin * 4 } };
+			if (AABBContains(hugeBox, current)) return false;
+		}
+
+		removeLeaf(proxy);
+		nodes[proxy].box = fatBox;
+		insertLeaf(proxy);
+		return true;
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//      _                  _   _              __ 
+	//     (_)_ _  ___ ___ _ _| |_| |   ___ __ _ / _|
+	//     | | ' \(_-</ -_) '_|  _| |__/ -_) _` |  _|
+	//     |_|_||_/__/\___|_|  \__|____\___\__,_|_|  
+	//                                               
+	// Walk down from the root picking whichever child grows the least, then pair the leaf with the node we end up at
+	void insertLeaf(int leaf)
+	{
+		if (root == -1)
+		{
+			root = leaf;
+			nodes[root].parent = -1;
+			return;
+		}
+
+		// Find the best sibling, cost = perimeter of the new branch + how much every ancestor grows
+		AABB leafBox = nodes[leaf].box;
+		int index = root;
+		while (!isLeaf(index))
+		{
+			int left = nodes[index].left;
+			int right = nodes[index].right;
+			float area = AABBPerimeter(nodes[index].box);
+			float combinedArea = AABBPerimeter(AABBUnion(nodes[index].box, leafBox));
+			float cost = 2 * combinedArea; // Cost of creating a new branch here for the leaf and this node
+			float inheritanceCost = 2 * (combinedArea - area); // Minimum cost of pushing the leaf further down
+
+			float costLeft = AABBPerimeter(AABBUnion(leafBox, nodes[left].box)) + inheritanceCost;
+			if (!isLeaf(left)) costLeft -= AABBPerimeter(nodes[left].box);
+			float costRight = AABBPerimeter(AABBUnion(leafBox, nodes[right].box)) + inheritanceCost;
+			if (!isLeaf(right)) costRight -= AABBPerimeter(nodes[right].box);
+
+			if (cost < costLeft && cost < costRight) break;
+			index = (costLeft < costRight) ? left : right;
+		}
+
+		// New branch replaces the sibling and takes the sibling and the leaf as its children
+		int sibling = index;
+		int oldParent = nodes[sibling].parent;
+		int newParent = allocateNode();
+		nodes[newParent].parent = oldParent;
+		nodes[newParent].box = AABBUnion(leafBox, nodes[sibling].box);
+		nodes[newParent].height = nodes[sibling].height + 1;
+		nodes[newParent].left = sibling;
+		nodes[newParent].right = leaf;
+		nodes[sibling].parent = newParent;
+		nodes[leaf].parent = newParent;
+		if (oldParent == -1)
+		{
+			root = newParent;
+		}
+		else if (nodes[oldParent].left == sibling)
+		{
+			nodes[oldParent].left = newParent;
+		}
+		else
+		{
+			nodes[oldParent].right = newParent;
+		}
+
+		refitAncestors(nodes[leaf].parent);
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//                                _              __ 
+	//      _ _ ___ _ __  _____ _____| |   ___ __ _ / _|
+	//     | '_/ -_) '  \/ _ \ V / -_) |__/ -_) _` |  _|
+	//     |_| \___|_|_|_\___/\_/\___|____\___\__,_|_|  
+	//                                                  
+	// Unlink a leaf, its sibling takes the place of their shared parent
+	void removeLeaf(int leaf)
+	{
+		if (leaf == root)
+		{
+			root = -1;
+			return;
+		}
+
+		int parent = nodes[leaf].parent;
+		int grandParent = nodes[parent].parent;
+		int sibling = (nodes[parent].left == leaf) ? nodes[parent].right : nodes[parent].left;
+		freeNode(parent);
+
+		if (grandParent == -1)
+		{
+			root = sibling;
+			nodes[sibling].parent = -1;
+			return;
+		}
+
+		if (nodes[grandParent].left == parent) nodes[grandParent].left = sibling;
+		else nodes[grandParent].right = sibling;
+		nodes[sibling].parent = grandParent;
+		refitAncestors(grandParent);
+	}
+
+	// Rebalance, resize and recompute the height of every node from index up to the root
+	void refitAncestors(int index)
+	{
+		while (index != -1)
+		{
+			index = balance(index);
+			int left = nodes[index].left;
+			int right = nodes[index].right;
+			nodes[index].height = 1 + max(nodes[left].height, nodes[right].height);
+			nodes[index].box = AABBUnion(nodes[left].box, nodes[right].box);
+			index = nodes[index].parent;
+		}
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//      _          _                  
+	//     | |__  __ _| |__ _ _ _  __ ___ 
+	//     | '_ \/ _` | / _` | ' \/ _/ -_)
+	//     |_.__/\__,_|_\__,_|_||_\__\___|
+	//                                    
+	// If one child of node a is more than one level taller than the other, rotate it up to take a's place. Returns the node now at a's position
+	int balance(int a)
+	{
+		if (isLeaf(a) || nodes[a].height < 2) return a;
+
+		int b = nodes[a].left;
+		int c = nodes[a].right;
+		int heightDifference = nodes[c].height - nodes[b].height;
+		if (heightDifference >= -1 && heightDifference <= 1) return a;
+
+		// The taller child moves up, a moves down into its place and takes one of the taller child's children
+		int up = (heightDifference > 1) ? c : b;
+		int other = (up == c) ? b : c;
+		int upLeft = nodes[up].left;
+		int upRight = nodes[up].right;
+
+		nodes[up].left = a;
+		nodes[up].parent = nodes[a].parent;
+		nodes[a].parent = up;
+		if (nodes[up].parent == -1) root = up;
+		else if (nodes[nodes[up].parent].left == a) nodes[nodes[up].parent].left = up;
+		else nodes[nodes[up].parent].right = up;
+
+		// The taller grandchild stays with up, the shorter one goes to a in the slot up used to fill
+		int keep = (nodes[upLeft].height > nodes[upRight].height) ? upLeft : upRight;
+		int give = (keep == upLeft) ? upRight : upLeft;
+		nodes[up].right = keep;
+		if (up == c) nodes[a].right = give;
+		else nodes[a].left = give;
+		nodes[give].parent = a;
+
+		nodes[a].box = AABBUnion(nodes[other].box, nodes[give].box);
+		nodes[a].height = 1 + max(nodes[other].height, nodes[give].height);
+		nodes[up].box = AABBUnion(nodes[a].box, nodes[keep].box);
+		nodes[up].height = 1 + max(nodes[a].height, nodes[keep].height);
+		return up;
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//                             
+	//      __ _ _  _ ___ _ _ _  _ 
+	//     / _` | || / -_) '_| || |
+	//     \__, |\_,_\___|_|  \_, |
+	//        |_|             |__/ 
+	// Call callback(object) for every leaf whose box overlaps area, stop early if the callback returns false
+	template <typename Callback>
+	void query(AABB area, Callback callback)
+	{
+		query(area, callback, stack);
+	}
+
+	// Same as above with a caller owned traversal stack, so several threads can query the tree at once
+	template <typename Callback>
+	void query(AABB area, Callback callback, vector<int>& stack) const
+	{
+		if (root == -1) return;
+		stack.clear();
+		stack.push_back(root);
+		while (!stack.empty())
+		{
+			int node = stack.back();
+			stack.pop_back();
+			if (!AABBOverlap(nodes[node].box, area)) continue;
+			if (isLeaf(node))
+			{
+				if (!callback(nodes[node].object)) return;
+			}
+			else
+			{
+				stack.push_back(nodes[node].left);
+				stack.push_back(nodes[node].right);
+			}
+		}
+	}
+
+	template <typename Callback>
+	void queryPoint(Vector2 point, Callback callback)
+	{
+		query({ point, point }, callback);
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//                     ___         _   
+	//      _ _ __ _ _  _ / __|__ _ __| |_ 
+	//     | '_/ _` | || | (__/ _` (_-<  _|
+	//     |_| \__,_|\_, |\___\__,_/__/\__|
+	//               |__/                  
+	// Call callback(object, maxFraction) for every leaf the segment from start to end passes through, the callback returns the fraction of the segment to keep searching (0 stops)
+	template <typename Callback>
+	void rayCast(Vector2 start, Vector2 end, Callback callback)
+	{
+		if (root == -1) return;
+		Vector2 direction = Vector2Subtract(end, start);
+		if (Vector2LengthSqr(direction) <= 0) return;
+		Vector2 perpendicular = Vector2Normalize({ -direction.y, direction.x }); // Separating axis for the segment itself
+		Vector2 absPerpendicular = { fabsf(perpendicular.x), fabsf(perpendicular.y) };
+
+		float maxFraction = 1.0f;
+		Vector2 segmentEnd = start + direction * maxFraction;
+		AABB segmentBox = { Vector2Min(start, segmentEnd), Vector2Max(start, segmentEnd) };
+
+		stack.clear();
+		stack.push_back(root);
+		while (!stack.empty())
+		{
+			int node = stack.back();
+			stack.pop_back();
+			AABB box = nodes[node].box;
+			if (!AABBOverlap(box, segmentBox)) continue;
+
+			// Skip boxes that lie entirely on one side of the infinite line through the segment
+			Vector2 center = (box.min + box.max) * 0.5f;
+			Vector2 halfExtents = (box.max - box.min) * 0.5f;
+			float separation = fabsf(Vector2DotProduct(perpendicular, start - center)) - Vector2DotProduct(absPerpendicular, halfExtents);
+			if (separation > 0) continue;
+
+			if (isLeaf(node))
+			{
+				float fraction = callback(nodes[node].object, maxFraction);
+				if (fraction <= 0) return;
+				if (fraction < maxFraction)
+				{
+					// Hit something closer, shrink the segment so farther boxes get culled
+					maxFraction = fraction;
+					segmentEnd = start + direction * maxFraction;
+					segmentBox = { Vector2Min(start, segmentEnd), Vector2Max(start, segmentEnd) };
+				}
+			}
+			else
+			{
+				stack.push_back(nodes[node].left);
+				stack.push_back(nodes[node].right);
+			}
+		}
+	}
+
+private:
+	vector<int> stack; // Traversal stack for the queries, kept around so it doesn't allocate every call
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+//        _     _    ___         _             
+//       (_)___| |__/ __|_  _ __| |_ ___ _ __  
+//       | / _ \ '_ \__ \ || (_-<  _/ -_) '  \ 
+//      _/ \___/_.__/___/\_, /__/\__\___|_|_|_|
+//     |__/              |__/                  
+// Work stealing thread pool the world step runs on
+/* Every thread has its own deque of tasks. A thread pushes and pops at the back of its own deque (newest first, the data
+   is probably still in cache) and when it runs dry it steals the oldest task from the front of someone else's.
+   Deque 0 belongs to the main thread, which helps out while it waits for a jobGraph to finish.
+   With 0 workers the main thread runs every task itself */
+class jobSystem
+{
+public:
+	jobSystem() { queues.push_back(make_unique<taskQueue>()); }
+	~jobSystem() { stop(); }
+
+	// Restart the pool with workerCount background threads, 0 is single thread mode. Don't call while a graph is running
+	void start(int workerCount)
+	{
+		stop();
+		queues.clear();
+		for (int i = 0; i <= workerCount; i++) {
+			queues.push_back(make_unique<taskQueue>());
+		}
+		quitting = false;
+		for (int i = 1; i <= workerCount; i++) {
+			threads.emplace_back([this, i]() { workerLoop(i); });
+		}
+	}
+
+	void stop()
+	{
+		{
+			lock_guard<mutex> lock(sleepMutex);
+			quitting = true;
+		}
+		wake.notify_all();
+		for (thread& worker : threads) {
+			worker.join();
+		}
+		threads.clear();
+	}
+
+	int workerCount() { return (int)threads.size(); }
+
+	// Deque of the calling thread, 0 for the main thread (and any thread that isn't a worker)
+	static int& currentQueue()
+	{
+		static thread_local int queue = 0;
+		return queue;
+	}
+
+	// Add a task to the back of the calling thread's deque and wake a sleeping worker to steal it
+	void push(function<void()> task)
+	{
+		taskQueue& queue = *queues[currentQueue()];
+		{
+			lock_guard<mutex> lock(queue.lock);
+			queue.tasks.push_back(move(task));
+		}
+		{
+			lock_guard<mutex> lock(sleepMutex); // Taken so a worker can't miss the wake up between checking pending and sleeping
+			pending++;
+		}
+		wake.notify_one();
+	}
+
+	// Call work(begin, end) on chunks of [0, count) at most grain long and return once they are all done
+	// The calling thread runs chunks too while it waits, so a job can use this to fan out work it only finds out about while running
+	void parallelFor(int count, int grain, const function<void(int, int)>& work)
+	{
+		atomic<int> chunksLeft{ (count + grain - 1) / grain };
+		for (int begin = 0; begin < count; begin += grain) {
+			int end = min(begin + grain, count);
+			push([&work, &chunksLeft, begin, end]() { work(begin, end); chunksLeft--; });
+		}
+		int self = currentQueue();
+		while (chunksLeft > 0)
+		{
+			if (!runOne(self)) this_thread::yield();
+		}
+	}
+
+	// Run one task from deque self, or stolen from another deque, returns false if there was nothing to do
+	bool runOne(int self)
+	{
+		function<void()> task;
+		if (!pop(self, task) && !steal(self, task)) return false;
+		task();
+		return true;
+	}
+
+private:
+	struct taskQueue
+	{
+		mutex lock;
+		deque<function<void()>> tasks;
+	};
+
+	vector<unique_ptr<taskQueue>> queues;
+	vector<thread> threads;
+	mutex sleepMutex;
+	condition_variable wake;
+	atomic<int> pending{ 0 }; // Tasks sitting in any deque
+	bool quitting = false;
+
+	bool pop(int self, function<void()>& task)
+	{
+		taskQueue& queue = *queues[self];
+		lock_guard<mutex> lock(queue.lock);
+		if (queue.tasks.empty()) return false;
+		task = move(queue.tasks.back());
+		queue.tasks.pop_back();
+		pending--;
+		return true;
+	}
+
+	bool steal(int self, function<void()>& task)
+	{
+		for (int k = 1; k < (int)queues.size(); k++) {
+			taskQueue& victim = *queues[(self + k) % queues.size()];
+			lock_guard<mutex> lock(victim.lock);
+			if (victim.tasks.empty()) continue;
+			task = move(victim.tasks.front());
+			victim.tasks.pop_front();
+			pending--;
+			return true;
+		}
+		return false;
+	}
+
+	void workerLoop(int self)
+	{
+		currentQueue() = self;
+		while (true)
+		{
+			if (runOne(self)) continue;
+			unique_lock<mutex> lock(sleepMutex);
+			wake.wait(lock, [this]() { return pending > 0 || quitting; });
+			if (quitting) return;
+		}
+	}
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+//        _     _     ___               _    
+//       (_)___| |__ / __|_ _ __ _ _ __| |_  
+//       | / _ \ '_ \ (_ | '_/ _` | '_ \ ' \ 
+//      _/ \___/_.__/\___|_| \__,_| .__/_||_|
+//     |__/                       |_|        
+// Jobs with explicit dependencies, a job starts once every job it depends on has finished
+/* A job is either a single task or a parallel for, which is split into chunks of grain items that the pool can spread
+   over the workers. The item count of a parallel for is asked for when the job starts, so it can depend on an earlier job
+   (like the number of pairs the broadphase found). Chunk boundaries only depend on the count and the grain, never on
+   the number of threads, so as long as chunks write to separate data the result is the same on any worker count.
+   Jobs marked mainThread only run on the thread that called run(), for anything that calls raylib draw functions */
+class jobGraph
+{
+public:
+	bool timing = false; // Add up how long every job spends working, see forEachTiming
+
+	// Single task job, returns its id for dependsOn, name is only for reporting timings
+	int add(const char* name, function<void()> work, bool mainThread = false)
+	{
+		jobNode& node = nodes.emplace_back();
+		node.name = name;
+		node.work = move(work);
+		node.mainThread = mainThread;
+		return (int)nodes.size() - 1;
+	}
+
+	// Parallel for job, calls work(begin, end) for chunks of [0, count()) at most grain long
+	int addParallelFor(const char* name, function<int()> count, int grain, function<void(int, int)> work)
+	{
+		jobNode& node = nodes.emplace_back();
+		node.name = name;
+		node.count = move(count);
+		node.grain = grain;
+		node.range = move(work);
+		return (int)nodes.size() - 1;
+	}
+
+	// job won't start until prerequisite has finished
+	void dependsOn(int job, int prerequisite)
+	{
+		nodes[prerequisite].dependents.push_back(job);
+		nodes[job].prerequisites++;
+	}
+
+	bool empty() { return nodes.empty(); }
+
+	// Calls report(name, milliseconds) with the time every job has spent working since timing was switched on
+	// A parallel for adds up all of its chunks, so on several workers it can come to more than the wall clock time
+	void forEachTiming(function<void(const char*, double)> report)
+	{
+		for (jobNode& node : nodes) {
+			report(node.name, node.nanoseconds / 1e6);
+		}
+	}
+
+	// Run every job once and return when they have all finished, the calling thread helps out while it waits
+	void run(jobSystem& jobs)
+	{
+		jobsLeft = (int)nodes.size();
+		for (jobNode& node : nodes) {
+			node.waitingOn = node.prerequisites;
+		}
+		for (int i = 0; i < (int)nodes.size(); i++) {
+			if (nodes[i].prerequisites == 0) schedule(jobs, i);
+		}
+
+		int self = jobSystem::currentQueue();
+		while (jobsLeft > 0)
+		{
+			int mainJob = -1;
+			{
+				lock_guard<mutex> lock(mainLock);
+				if (!mainReady.empty())
+				{
+					mainJob = mainReady.back();
+					mainReady.pop_back();
+				}
+			}
+			if (mainJob != -1)
+			{
+				timed(mainJob, nodes[mainJob].work);
+				finish(jobs, mainJob);
+			}
+			else if (!jobs.runOne(self))
+			{
+				this_thread::yield(); // Everything left is running on a worker
+			}
+		}
+	}
+
+private:
+	struct jobNode
+	{
+		const char* name = "";
+		function<void()> work;
+		function<int()> count; // Only set for a parallel for
+		function<void(int, int)> range;
+		int grain = 1;
+		bool mainThread = false;
+		vector<int> dependents;
+		int prerequisites = 0;
+		atomic<int> waitingOn{ 0 }; // Prerequisites that haven't finished yet this run
+		atomic<int> chunksLeft{ 0 };
+		atomic<long long> nanoseconds{ 0 }; // Time spent working, only counted while timing
+	};
+
+	deque<jobNode> nodes; // deque so adding a job never moves the atomics of the others
+	atomic<int> jobsLeft{ 0 };
+	mutex mainLock;
+	vector<int> mainReady; // Ready jobs that have to run on the main thread
+
+	// Called once every prerequisite of job i is done
+	void schedule(jobSystem& jobs, int i)
+	{
+		jobNode& node = nodes[i];
+		if (node.mainThread)
+		{
+			lock_guard<mutex> lock(mainLock);
+			mainReady.push_back(i);
+			return;
+		}
+		if (!node.range)
+		{
+			jobs.push([this, &jobs, i]() { timed(i, nodes[i].work); finish(jobs, i); });
+			return;
+		}
+
+		int count = node.count();
+		int chunks = (count + node.grain - 1) / node.grain;
+		if (chunks <= 0)
+		{
+			finish(jobs, i); // Nothing to do, let the jobs after it start
+			return;
+		}
+		node.chunksLeft = chunks;
+		for (int chunk = 0; chunk < chunks; chunk++) {
+			int begin = chunk * node.grain;
+			int end = min(begin + node.grain, count);
+			jobs.push([this, &jobs, i, begin, end]() {
+				timed(i, [&]() { nodes[i].range(begin, end); });
+				if (--nodes[i].chunksLeft == 0) finish(jobs, i);
+			});
+		}
+	}
+
+	// Run work for job i, adding the time it took to the job's total when timing
+	template<typename Work>
+	void timed(int i, const Work& work)
+	{
+		if (!timing)
+		{
+			work();
+			return;
+		}
+		double start = GetTime();
+		work();
+		nodes[i].nanoseconds += (long long)((GetTime() - start) * 1e9);
+	}
+
+	void finish(jobSystem& jobs, int i)
+	{
+		for (int next : nodes[i].dependents) {
+			if (--nodes[next].waitingOn == 0) schedule(jobs, next);
+		}
+		jobsLeft--; // Last, so run() can't return while a dependent is still being scheduled
+	}
+};
+
+// Thread pool for the physics step, main() starts the workers
+jobSystem jobs;
+
+// Every core but the one the main thread is on
+int defaultWorkerCount()
+{
+	unsigned int cores = thread::hardware_concurrency(); // 0 if it can't tell
+	return cores > 1 ? (int)cores - 1 : 0;
+}
+
+// What a debug line shows, each one can be switched off on its own
+enum DebugCategory
+{
+	DEBUG_GRAVITY = 1 << 0,
+	DEBUG_NET_FORCE = 1 << 1,
+	DEBUG_NORMAL = 1 << 2, // Normal force from halfspaces
+	DEBUG_FRICTION = 1 << 3,
+	DEBUG_ALL = DEBUG_GRAVITY | DEBUG_NET_FORCE | DEBUG_NORMAL | DEBUG_FRICTION
+};
+
+struct debugLine
+{
+	Vector2 start;
+	Vector2 end;
+	float thickness;
+	Color color;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+//         _     _              ___                  ___                   _         
+//      __| |___| |__ _  _ __ _|   \ _ _ __ ___ __ _| _ \___ __ ___ _ _ __| |___ _ _ 
+//     / _` / -_) '_ \ || / _` | |) | '_/ _` \ V  V /   / -_) _/ _ \ '_/ _` / -_) '_|
+//     \__,_\___|_.__/\_,_\__, |___/|_| \__,_|\_/\_/|_|_\___\__\___/_| \__,_\___|_|  
+//                        |___/                                                      
+// Debug lines the physics step wants drawn, recorded during the step and drawn by Draw()
+/* The physics code never calls raylib itself, so the step can run on worker threads, headless, or several times a frame.
+   Every thread records into its own buffer (indexed like the job system deques) so recording doesn't need a lock.
+   Check wants() before working out a line, with every category off the only cost is that check.
+   clear() runs at the start of each step, so Draw() always shows the lines of the latest step */
+class debugDrawRecorder
+{
+public:
+	unsigned int categories = DEBUG_ALL; // DebugCategory bits that get recorded
+
+	bool wants(unsigned int category) { return (categories & category) != 0; }
+
+	void addLine(Vector2 start, Vector2 end, float thickness, Color color)
+	{
+		buffers[jobSystem::currentQueue()].push_back({ start, end, thickness, color });
+	}
+
+	// Line from origin along vector, for forces and velocities
+	void addVector(Vector2 origin, Vector2 vector, float thickness, Color color)
+	{
+		addLine(origin, origin + vector, thickness, color);
+	}
+
+	// Forget the last step's lines, threads is how many deques the job system has
+	void clear(int threads)
+	{
+		buffers.resize(threads);
+		for (vector<debugLine>& buffer : buffers) {
+			buffer.clear();
+		}
+	}
+
+	// Draw everything recorded, main thread only
+	void flush()
+	{
+		for (vector<debugLine>& buffer : buffers) {
+			for (debugLine& line : buffer) {
+				DrawLineEx(line.start, line.end, line.thickness, line.color);
+			}
+		}
+	}
+
+private:
+	vector<vector<debugLine>> buffers = vector<vector<debugLine>>(1);
+};
+
+// Debug lines of the latest physics step
+debugDrawRecorder debugDraw;
+
+// Fixed timestep state that lives outside the world (simTime, accumulator, physicsRate), saved along with it
+struct simulationClock
+{
+	float simTime;
+	float accumulator;
+	float physicsRate;
+};
+
+const unsigned int SNAPSHOT_MAGIC = 0x53594850; // "PHYS" in a little endian file
+const unsigned int SNAPSHOT_VERSION = 2; // Goes up whenever the layout changes, loadSnapshot refuses other versions
+
+// Start of a world snapshot, the arrays it counts follow it, see physicsWorld::saveSnapshot
+struct snapshotHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int bodyBytes; // Size of one body over all the arrays, catches a body array added without bumping the version
+	unsigned int checksum; // ComputeCRC32 of everything after the header
+	int bodyCount;
+	int halfspaceCount;
+	int handleCount; // Handle table entries
+	int freeHandleCount;
+	int contactCount; // Contact cache entries
+	int treeNodeCount;
+	int treeRoot;
+	int treeFreeList;
+	int watchCount; // Floats in wakeWatch
+	unsigned int objCount;
+	unsigned int islandCount;
+	unsigned int randomState;
+	Vector2 gravityAcceleration;
+	simulationClock clock;
+};
+
+// Physics World class
+class physicsWorld {
+private:
+	unsigned int objCount = 0;
+public:
+
+	// Variables for physics world
+	Vector2 gravityAcceleration; // Gravity acceleration vector
+	physicsBodies bodies; // Simulation data of every object, the physics stages only work on this
+	vector<physicObject*> objects; // Views for drawing, objects[i] looks at slot i of bodies
+	unsigned int randomState = 2463534242u; // xorshift32 state for spawned circle sizes, rand() gives a different sequence in every C library
+
+	// Handles
+	vector<int> handleIndex; // Body slot of every handle table entry, -1 while the entry is free
+	vector<unsigned int> handleGeneration; // Goes up every time the entry is freed
+	vector<unsigned int> freeHandles; // Entries ready to be reused, last one goes out first
+
+	// Broadphase
+	BroadphaseMode broadphase = BROADPHASE_GRID; // Toggle with B to compare against brute force
+	spatialGrid grid;
+	dynamicTree tree;
+	vector<int> unbounded; // Objects that can't be put in the grid (halfspaces)
+	vector<collisionPair> pairs; // Every candidate pair this frame, in the same order the brute force loop would visit them
+
+	// Scratch space for one chunk of bodies while the pairs are gathered in parallel, merged into pairs in chunk order
+	struct pairChunk
+	{
+		vector<collisionPair> pairs;
+		vector<int> candidates; // Candidates for the object being checked
+		vector<int> stack; // Tree traversal stack
+	};
+	vector<pairChunk> pairChunks;
+
+	// Narrowphase
+	NarrowphaseMode narrowphaseMode = NARROWPHASE_SIMD; // Toggle with N
+	bool verifySimd = false; // Toggle with V, checks every pair the SIMD filter rejects against the exact scalar test, see filterPairs
+	atomic<int> narrowphaseMismatches{ 0 }; // Overlapping pairs the SIMD filter rejected last step, should always be 0
+	unsigned int pairTests = 0; // Pairs sent to a collision response last frame
+	unsigned int contactCount = 0; // Pairs that actually overlapped last frame
+	vector<unsigned char> pairMightOverlap; // SIMD rejection result for pairs[p], computed for the whole list before any response runs
+	vector<unsigned char> pairTouching; // pairs[p] overlaps at the start of the step, only filled in for the colored solve
+
+	// Colored solve
+	bool coloredSolve = true; // Toggle with P, solve the pairs in color batches on every worker instead of one at a time in order
+	static const int MAX_COLORS = 64; // One bit per color in bodyColors
+	int colorCount = 0; // Colors used last step
+	vector<unsigned long long> bodyColors; // Colors object i already has a pair in
+	vector<int> pairColor; // Color of pairs[p], MAX_COLORS for overflow
+	vector<int> colorOffsets; // Pairs of color c are coloredPairs[colorOffsets[c]] to coloredPairs[colorOffsets[c + 1] - 1]
+	vector<int> colorFill;
+	vector<int> coloredPairs; // Indices into pairs, sorted by color
+	vector<unsigned char> pairContact; // Response for pairs[p] found an overlap during the colored solve
+
+	// Contact cache
+	float contactHysteresis = 2.0f; // Pixels two surfaces can drift apart before their cached contact is dropped
+	vector<cachedContact> contactCache; // Sorted by key
+	vector<cachedContact> freshContacts;
+	vector<int> pairCache; // Index into contactCache of pairs[p], -1 if the pair is too far apart to have a contact
+	vector<float> pairSeparation; // Distance between the surfaces of pairs[p] at the start of the step
+	int persistentContacts = 0; // Contacts this step that were already cached last step
+
+	// Impulse solver
+	SolverMode solver = SOLVER_POSITION; // Cycle with I, brute force always uses the position solver
+	int solverIterations = 8; // Passes over every contact per step
+	float restitution = 0.3f; // Bounciness, 0 stops dead, 1 bounces back at full speed
+	float restitutionThreshold = 100.0f; // Contacts closing slower than this (pixels per second) don't bounce, so piles settle
+	float baumgarte = 0.2f; // Fraction of the overlap turned into separating velocity each step
+	float penetrationSlop = 0.5f; // Overlap in pixels left alone, so resting contacts don't flicker between touching and not
+	float maxCorrectionSpeed = 100.0f; // Fastest the overlap is pushed out (pixels per second), deep overlap at the bottom of a tall pile would launch bodies otherwise
+	bool warmStarting = true; // Start every contact from the impulses it ended with last step
+
+	// One contact prepared for the impulse solver
+	struct contactConstraint
+	{
+		int a, b; // For halfspace contacts a is the halfspace
+		int cache; // Index into contactCache, where the accumulated impulses live
+		Vector2 normal; // From a to b
+		float normalMass; // 1 / (inverse mass a + inverse mass b)
+		float friction; // Grip of both bodies multiplied, like the position solver
+		float velocityBias; // Normal velocity the contact aims for, from the gap, overlap or bounce
+	};
+	vector<contactConstraint> constraints;
+
+	// Substep solver
+	int substeps = 8; // Predict, project, derive velocity passes per step
+	float contactCompliance = 0.0f; // Inverse stiffness of a contact, 0 is perfectly rigid, higher lets piles squash a little
+	float substepMargin = 2.0f; // Extra pixels on top of how far a pair can close in one step before it's left out of the substeps
+	vector<int> substepPairs; // Indices into pairs that can touch at some point this step, projected every substep
+	vector<float> pairNormalLambda; // Total normal correction of substepPairs[k] this step, for contacts and debug lines
+	vector<float> pairTangentLambda; // Total friction correction of substepPairs[k] this step
+	vector<float> pairOverlapAllowance; // Overlap substepPairs[k] started the step with that hasn't been pushed out yet, see maxCorrectionSpeed
+	vector<float> substepStartX, substepStartY; // Positions at the start of the current substep
+
+	// Continuous collision
+	bool continuousCollision = true; // Toggle with K, sweep fast circles so they can't skip through thin bodies or a halfspace
+	float ccdMotionFraction = 0.5f; // Circles that moved further than this fraction of their radius in one step get swept
+	float ccdSkin = 0.25f; // Pixels a swept circle stops short of what it hits (impulse solver), or overlapping it (position solver, which only reacts to overlap)
+	int ccdSubsteps = 4; // Most times one circle is stopped and slid along a surface in one step
+	int sweptCount = 0; // Circles that hit something while being swept last step
+	vector<int> fastBodies; // Circles integrate is about to move further than ccdMotionFraction of their radius
+	vector<Vector2> sweepStart; // Where each of them was before integrate moved it
+
+	// Sleeping
+	bool allowSleep = true; // Toggle with S, resting islands stop being simulated until something touches them
+	float sleepSpeed = 5.0f; // Bodies that moved slower than this last step (pixels per second) count as resting
+	float sleepEnergy = 5.0f; // Most kinetic energy per body (0.5 * m * v^2) an island can have and still fall asleep
+	float sleepTime = 0.5f; // Seconds every body of an island has to rest before the island sleeps
+	int sleepingCount = 0; // Bodies asleep after the last step
+	unsigned int islandCount = 0; // Islands put to sleep so far, used to number them
+	vector<collisionPair> contacts; // Pairs that overlapped this step, the edges of the contact graph
+	vector<int> islandParent; // Union find over the contact graph, root of each body's island
+	vector<float> islandTimer; // Shortest sleepTimer in the island, only valid at the root
+	vector<float> islandEnergy; // Kinetic energy of the island, only valid at the root
+	vector<int> islandSize;
+	vector<unsigned int> islandLabel; // Number given to the island when it falls asleep, 0 while it hasn't got one
+	vector<unsigned int> wakingIslands;
+	vector<float> wakeWatch; // Gravity and halfspace settings the sleeping bodies rested under, any change wakes everything
+
+	// Job system
+	jobGraph stepGraph; // Stages of one step and what each one waits for, built on the first step
+	static const int BODY_GRAIN = 512; // Bodies per parallel for chunk, a multiple of the SIMD width
+	static const int PAIR_GRAIN = 1024; // Pairs per parallel for chunk, a multiple of NARROWPHASE_LANES
+
+	// Functions
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//        _      _    _       _     _        _   
+	//       /_\  __| |__| |  ___| |__ (_)___ __| |_ 
+	//      / _ \/ _` / _` | / _ \ '_ \| / -_) _|  _|
+	//     /_/ \_\__,_\__,_| \___/_.__// \___\__|\__|
+	//                               |__/            
+	// Add object to physics world, external objects stay owned by the caller and are never removed by cleanup
+	bodyHandle addObject(physicObject* obj, bool external = false) {
+		obj->bodies = &bodies;
+		obj->index = bodies.add((obj->Shape() == CIRCLE ? BODY_CIRCLE : BODY_HALFSPACE) | (external ? BODY_EXTERNAL : 0));
+		bodies.id[obj->index] = objCount;
+		objects.push_back(obj);
+		objCount++;
+
+		unsigned int slot;
+		if (freeHandles.empty()) {
+			slot = (unsigned int)handleIndex.size();
+			handleIndex.push_back(-1);
+			handleGeneration.push_back(0);
+		}
+		else {
+			slot = freeHandles.back();
+			freeHandles.pop_back();
+		}
+		handleIndex[slot] = obj->index;
+		bodies.handle[obj->index] = slot;
+		obj->handle = { slot, handleGeneration[slot] };
+		return obj->handle;
+	}
+
+	// Slot in the body arrays of the body handle refers to, -1 if it was removed
+	int indexOf(bodyHandle handle) {
+		if (handle.slot >= handleIndex.size() || handleGeneration[handle.slot] != handle.generation) return -1;
+		return handleIndex[handle.slot];
+	}
+
+	// View of the body handle refers to, nullptr if it was removed
+	physicObject* getObject(bodyHandle handle) {
+		int i = indexOf(handle);
+		return i == -1 ? nullptr : objects[i];
+	}
+
+	// Random integer from 0 to count - 1, the same sequence on every platform so replays spawn the same circles
+	int randomInt(int count) {
+		randomState ^= randomState << 13;
+		randomState ^= randomState >> 17;
+		randomState ^= randomState << 5;
+		return (int)(randomState % (unsigned int)count);
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//                                 ___  _     _        _      
+	//      _ _ ___ _ __  _____ _____ / _ \| |__ (_)___ __| |_ ___
+	//     | '_/ -_) '  \/ _ \ V / -_) (_) | '_ \| / -_) _|  _(_-<
+	//     |_| \___|_|_|_\___/\_/\___|\___/|_.__// \___\__|\__/__/
+	//                                         |__/               
+	// Remove every object with remove[i] set in one pass, the caller still owns the views
+	/* Walks the list once, each kept object moves straight to its final slot, so removing a wave of objects is O(n)
+	   rather than O(n^2) for an erase per object */
+	void removeObjects(const unsigned char* remove) {
+		int kept = 0;
+		for (int i = 0; i < objects.size(); i++) {
+			if (remove[i]) {
+				if (bodies.proxyId[i] != -1) tree.destroyProxy(bodies.proxyId[i]); // Take it out of the broadphase tree
+				freeHandle(bodies.handle[i]);
+				continue;
+			}
+			objects[kept] = objects[i];
+			objects[kept]->index = kept;
+			handleIndex[bodies.handle[i]] = kept;
+			if (bodies.proxyId[i] != -1) tree.nodes[bodies.proxyId[i]].object = kept; // Tree leaves point at slots too
+			kept++;
+		}
+		objects.resize(kept);
+		bodies.compact(remove);
+	}
+
+	// Give a handle table entry back, handles that still carry the old generation stop resolving
+	void freeHandle(unsigned int slot) {
+		handleIndex[slot] = -1;
+		handleGeneration[slot]++;
+		freeHandles.push_back(slot);
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//                            _ ___             __   __      _              
+	//      _ _ ___ __ ___ _ _ __| | __|__ _ _ __ __\ \ / /__ __| |_ ___ _ _ ___
+	//     | '_/ -_) _/ _ \ '_/ _` | _/ _ \ '_/ _/ -_) V / -_) _|  _/ _ \ '_(_-<
+	//     |_| \___\__\___/_| \__,_|_|\___/_| \__\___|\_/\___\__|\__\___/_| /__/
+	//                                                                          
+	// Record the gravity and net force vectors of moving objects [begin, end), kept out of integrate() so the hot pass stays lean
+	void recordForceVectors(int begin, int end)
+	{
+		for (int i = begin; i < end; i++) {
+			if (bodies.flags[i] & (BODY_STATIC | BODY_ASLEEP)) continue;
+			Vector2 gravityForce = gravityAcceleration * bodies.mass[i]; // F = m * a
+			if (debugDraw.wants(DEBUG_GRAVITY)) debugDraw.addVector(bodies.getPosition(i), gravityForce, 1, PURPLE); // Gravity force vector
+			if (debugDraw.wants(DEBUG_NET_FORCE))
+			{
+				Vector2 netForce = bodies.getForce(i) + gravityForce - bodies.getVelocity(i) * bodies.drag[i]; // Contact forces + gravity + drag
+				debugDraw.addVector(bodies.getPosition(i), netForce, 1, GRAY); // Net force vector
+			}
+		}
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//      _     _                     _       
+	//     (_)_ _| |_ ___ __ _ _ _ __ _| |_ ___ 
+	//     | | ' \  _/ -_) _` | '_/ _` |  _/ -_)
+	//     |_|_||_\__\___\__, |_| \__,_|\__\___|
+	//                   |___/                  
+	// Apply gravity, drag and the forces collected this step to objects [begin, end), move them, then clear the forces for the next step
+	/* One fused pass over the packed arrays instead of separate reset / gravity / kinematics loops, so each body is loaded
+	   and stored once per step. Drag is a linear damping force F = -drag * v.
+	   Static bodies have an inverse mass of 0, the SIMD lanes use that as a mask instead of branching on the flags */
+	void integrate(int begin, int end)
+	{
+		float* px = bodies.positionX.data();
+		float* py = bodies.positionY.data();
+		float* vx = bodies.velocityX.data();
+		float* vy = bodies.velocityY.data();
+		float* fx = bodies.forceX.data();
+		float* fy = bodies.forceY.data();
+		const float* im = bodies.inverseMass.data();
+		const float* drag = bodies.drag.data();
+		int i = begin;
+
+#if defined(PHYSICS_SIMD_AVX2)
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 timeStep = _mm256_set1_ps(dt);
+		const __m256 gravityX = _mm256_set1_ps(gravityAcceleration.x);
+		const __m256 gravityY = _mm256_set1_ps(gravityAcceleration.y);
+		for (; i + 8 <= end; i += 8) {
+			__m256 inverseMass = _mm256_loadu_ps(im + i);
+			__m256 dynamic = _mm256_cmp_ps(inverseMass, zero, _CMP_GT_OQ);
+			__m256 damping = _mm256_loadu_ps(drag + i);
+			__m256 positionX = _mm256_loadu_ps(px + i);
+			__m256 positionY = _mm256_loadu_ps(py + i);
+			__m256 velocityX = _mm256_loadu_ps(vx + i);
+			__m256 velocityY = _mm256_loadu_ps(vy + i);
+			// a = (F - drag * v) / m + g
+			__m256 accelerationX = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(fx + i), _mm256_mul_ps(damping, velocityX)), inverseMass), gravityX);
+			__m256 accelerationY = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(fy + i), _mm256_mul_ps(damping, velocityY)), inverseMass), gravityY);
+			// Position moves with the velocity from the start of the step, then velocity picks up this step's acceleration
+			_mm256_storeu_ps(px + i, _mm256_blendv_ps(positionX, _mm256_add_ps(positionX, _mm256_mul_ps(velocityX, timeStep)), dynamic));
+			_mm256_storeu_ps(py + i, _mm256_blendv_ps(positionY, _mm256_add_ps(positionY, _mm256_mul_ps(velocityY, timeStep)), dynamic));
+			_mm256_storeu_ps(vx + i, _mm256_blendv_ps(velocityX, _mm256_add_ps(velocityX, _mm256_mul_ps(accelerationX, timeStep)), dynamic));
+			_mm256_storeu_ps(vy + i, _mm256_blendv_ps(velocityY, _mm256_add_ps(velocityY, _mm256_mul_ps(accelerationY, timeStep)), dynamic));
+			_mm256_storeu_ps(fx + i, zero);
+			_mm256_storeu_ps(fy + i, zero);
+		}
+#elif defined(PHYSICS_SIMD_SSE2)
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 timeStep = _mm_set1_ps(dt);
+		const __m128 gravityX = _mm_set1_ps(gravityAcceleration.x);
+		const __m128 gravityY = _mm_set1_ps(gravityAcceleration.y);
+		for (; i + 4 <= end; i += 4) {
+			__m128 inverseMass = _mm_loadu_ps(im + i);
+			__m128 dynamic = _mm_cmpgt_ps(inverseMass, zero);
+			__m128 damping = _mm_loadu_ps(drag + i);
+			__m128 positionX = _mm_loadu_ps(px + i);
+			__m128 positionY = _mm_loadu_ps(py + i);
+			__m128 velocityX = _mm_loadu_ps(vx + i);
+			__m128 velocityY = _mm_loadu_ps(vy + i);
+			// a = (F - drag * v) / m + g
+			__m128 accelerationX = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(fx + i), _mm_mul_ps(damping, velocityX)), inverseMass), gravityX);
+			__m128 accelerationY = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(fy + i), _mm_mul_ps(damping, velocityY)), inverseMass), gravityY);
+			// SSE2 has no blend, keep the old value in static lanes with and/andnot
+			__m128 newPositionX = _mm_add_ps(positionX, _mm_mul_ps(velocityX, timeStep));
+			__m128 newPositionY = _mm_add_ps(positionY, _mm_mul_ps(velocityY, timeStep));
+			__m128 newVelocityX = _mm_add_ps(velocityX, _mm_mul_ps(accelerationX, timeStep));
+			__m128 newVelocityY = _mm_add_ps(velocityY, _mm_mul_ps(accelerationY, timeStep));
+			_mm_storeu_ps(px + i, _mm_or_ps(_mm_and_ps(dynamic, newPositionX), _mm_andnot_ps(dynamic, positionX)));
+			_mm_storeu_ps(py + i, _mm_or_ps(_mm_and_ps(dynamic, newPositionY), _mm_andnot_ps(dynamic, positionY)));
+			_mm_storeu_ps(vx + i, _mm_or_ps(_mm_and_ps(dynamic, newVelocityX), _mm_andnot_ps(dynamic, velocityX)));
+			_mm_storeu_ps(vy + i, _mm_or_ps(_mm_and_ps(dynamic, newVelocityY), _mm_andnot_ps(dynamic, velocityY)));
+			_mm_storeu_ps(fx + i, zero);
+			_mm_storeu_ps(fy + i, zero);
+		}
+#endif
+
+		// Leftover bodies that don't fill a whole SIMD register, same math one at a time
+		for (; i < end; i++) {
+			if (im[i] > 0.0f) {
+				float accelerationX = (fx[i] - drag[i] * vx[i]) * im[i] + gravityAcceleration.x;
+				float accelerationY = (fy[i] - drag[i] * vy[i]) * im[i] + gravityAcceleration.y;
+				px[i] += vx[i] * dt; // Velocity = change in position over time p/t, therefore change in position = velocity * time
+				py[i] += vy[i] * dt;
+				vx[i] += accelerationX * dt; // F = ma, so a = F/m where F is net force on an object, deltaV = a * time
+				vy[i] += accelerationY * dt;
+			}
+			fx[i] = 0.0f;
+			fy[i] = 0.0f;
+		}
+	}
+
+	// Impulse solver only: apply gravity, drag and collected forces to the velocities of objects [begin, end) before the contacts are solved
+	void integrateVelocities(int begin, int end)
+	{
+		for (int i = begin; i < end; i++) {
+			float inverseMass = bodies.inverseMass[i];
+			if (inverseMass > 0.0f)
+			{
+				bodies.velocityX[i] += ((bodies.forceX[i] - bodies.drag[i] * bodies.velocityX[i]) * inverseMass + gravityAcceleration.x) * dt;
+				bodies.velocityY[i] += ((bodies.forceY[i] - bodies.drag[i] * bodies.velocityY[i]) * inverseMass + gravityAcceleration.y) * dt;
+			}
+			bodies.forceX[i] = 0.0f;
+			bodies.forceY[i] = 0.0f;
+		}
+	}
+
+	// Impulse solver only: move objects [begin, end) with the velocities the contacts left them
+	void integratePositions(int begin, int end)
+	{
+		for (int i = begin; i < end; i++) {
+			if (bodies.inverseMass[i] > 0.0f)
+			{
+				bodies.positionX[i] += bodies.velocityX[i] * dt;
+				bodies.positionY[i] += bodies.velocityY[i] * dt;
+			}
+		}
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//             _ _ _    _     ___      _     
+	//      __ ___| | (_)__| |___| _ \__ _(_)_ _ 
+	//     / _/ _ \ | | / _` / -_)  _/ _` | | '_|
+	//     \__\___/_|_|_\__,_\___|_| \__,_|_|_|  
+	//                                           
+	// Run the collision response that matches the shapes of objects i and j, returns true if they overlapped
+	// contact is the pair's cache entry, the response records the impulses it used there
+	bool collidePair(int i, int j, cachedContact* contact = nullptr)
+	{
+		bool didCollide = false;
+
+		// Shape is read from the flags array, no need to go through the views
+		unsigned char shapeofA = bodies.flags[i] & (BODY_CIRCLE | BODY_HALFSPACE);
+		unsigned char shapeofB = bodies.flags[j] & (BODY_CIRCLE | BODY_HALFSPACE);
+
+		// Call appropriate collision response function based on object shapes
+		if (shapeofA == BODY_CIRCLE && shapeofB == BODY_CIRCLE)
+		{
+			didCollide = CircleCircleCollisionResponse(bodies, i, j);
+		}
+		else if (shapeofA == BODY_CIRCLE && shapeofB == BODY_HALFSPACE)
+		{
+			didCollide = CircleHalfspaceCollisionResponse(bodies, i, (physicsHalfspace*)objects[j], contact); // Halfspace view holds the normal
+		}
+		else if (shapeofA == BODY_HALFSPACE && shapeofB == BODY_CIRCLE)
+		{
+			didCollide = CircleHalfspaceCollisionResponse(bodies, j, (physicsHalfspace*)objects[i], contact);
+		}
+		return didCollide;
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//       __ _         _  ___     _    _ ___      _        
+	//      / _(_)_ _  __| |/ __|_ _(_)__| | _ \__ _(_)_ _ ___
+	//     |  _| | ' \/ _` | (_ | '_| / _` |  _/ _` | | '_(_-<
+	//     |_| |_|_||_\__,_|\___|_| |_\__,_|_| \__,_|_|_| /__/
+	//                                                        
+	// Fill candidates with every j > i that object i could be touching, using the grid built this frame
+	void findGridPairs(int i, vector<int>& candidates)
+	{
+		candidates.clear();
+		if (bodies.flags[i] & BODY_CIRCLE)
+		{
+			grid.forEachNeighbour(i, [&](int j) { if (j > i) candidates.push_back(j); }); // Only j > i, so each pair is found once
+			for (int j : unbounded) {
+				if (j > i) candidates.push_back(j); // Halfspaces are infinite, so they can't go in the grid and are paired with everything
+			}
+		}
+		else
+		{
+			for (int j = i + 1; j < bodies.size(); j++) {
+				if (bodies.flags[j] & BODY_CIRCLE) candidates.push_back(j);
+			}
+		}
+		// Same order as the brute force loop, responses move objects so the order has to match for both paths to agree
+		sort(candidates.begin(), candidates.end());
+	}
+
+	// Tight bounding box of circle i
+	AABB circleBox(int i)
+	{
+		Vector2 extents = { bodies.radius[i], bodies.radius[i] };
+		return { bodies.getPosition(i) - extents, bodies.getPosition(i) + extents };
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//                    _      _      _____            
+	//      _  _ _ __  __| |__ _| |_ __|_   _| _ ___ ___ 
+	//     | || | '_ \/ _` / _` |  _/ -_)| || '_/ -_) -_)
+	//      \_,_| .__/\__,_\__,_|\__\___||_||_| \___\___|
+	//          |_|                                      
+	// Create leaves for new circles and move the leaves of circles that left their fattened boxes
+	void updateTree()
+	{
+		for (int i = 0; i < bodies.size(); i++) {
+			if (!(bodies.flags[i] & BODY_CIRCLE)) continue; // Halfspaces are unbounded, the tree skips them
+			AABB box = circleBox(i);
+			if (bodies.proxyId[i] == -1)
+			{
+				bodies.proxyId[i] = tree.createProxy(box, i);
+			}
+			else
+			{
+				tree.moveProxy(bodies.proxyId[i], box, bodies.getVelocity(i) * dt);
+				tree.nodes[bodies.proxyId[i]].object = i; // Slot shifts whenever an earlier body is removed
+			}
+		}
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//       __ _         _ _____            ___      _        
+	//      / _(_)_ _  __| |_   _| _ ___ ___| _ \__ _(_)_ _ ___
+	//     |  _| | ' \/ _` | | || '_/ -_) -_)  _/ _` | | '_(_-<
+	//     |_| |_|_||_\__,_| |_||_| \___\___|_| \__,_|_|_| /__/
+	//                                                         
+	// Fill candidates with every j > i whose leaf overlaps the leaf of object i
+	void findTreePairs(int i, vector<int>& candidates, vector<int>& stack)
+	{
+		candidates.clear();
+		if (bodies.flags[i] & BODY_CIRCLE)
+		{
+			tree.query(tree.nodes[bodies.proxyId[i]].box, [&](int j) { if (j > i) candidates.push_back(j); return true; }, stack);
+			for (int j : unbounded) {
+				if (j > i) candidates.push_back(j);
+			}
+		}
+		else
+		{
+			for (int j = i + 1; j < bodies.size(); j++) {
+				if (bodies.flags[j] & BODY_CIRCLE) candidates.push_back(j);
+			}
+		}
+		sort(candidates.begin(), candidates.end()); // Same order as brute force, see findGridPairs
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//                             ___     _     _   
+	//      __ _ _  _ ___ _ _ _  _| _ \___(_)_ _| |_ 
+	//     / _` | || / -_) '_| || |  _/ _ \ | ' \  _|
+	//     \__, |\_,_\___|_|  \_, |_| \___/_|_||_\__|
+	//        |_|             |__/                   
+	// Scene queries, these go through the tree so they are only up to date while BROADPHASE_TREE is selected
+	// Circle containing point, nullptr if there isn't one
+	physicObject* queryPoint(Vector2 point)
+	{
+		physicObject* found = nullptr;
+		tree.queryPoint(point, [&](int j) {
+			if (Vector2DistanceSqr(point, bodies.getPosition(j)) > bodies.radius[j] * bodies.radius[j]) return true; // Inside the fat box but not the circle, keep looking
+			found = objects[j];
+			return false;
+		});
+		return found;
+	}
+
+	// Every circle whose bounding box overlaps area
+	void queryArea(AABB area, vector<physicObject*>& results)
+	{
+		tree.query(area, [&](int j) {
+			if (AABBOverlap(circleBox(j), area)) results.push_back(objects[j]);
+			return true;
+		});
+	}
+
+	// First circle hit by the segment from start to end, writes where it was hit to hitPoint
+	physicObject* rayCast(Vector2 start, Vector2 end, Vector2* hitPoint)
+	{
+		physicObject* hit = nullptr;
+		Vector2 direction = end - start;
+		float a = Vector2DotProduct(direction, direction);
+		tree.rayCast(start, end, [&](int j, float maxFraction) {
+			// Solve |start + direction * t - center| = radius for the smallest t
+			Vector2 offset = start - bodies.getPosition(j);
+			float b = Vector2DotProduct(offset, direction);
+			float c = Vector2DotProduct(offset, offset) - bodies.radius[j] * bodies.radius[j];
+			float discriminant = b * b - a * c;
+			if (discriminant < 0) return maxFraction; // Missed, keep the current segment
+			float t = (-b - sqrtf(discriminant)) / a;
+			if (t < 0 || t > maxFraction) return maxFraction;
+			hit = objects[j];
+			*hitPoint = start + direction * t;
+			return t;
+		});
+		return hit;
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//       __ _ _ _           ___      _        
+	//      / _(_) | |_ ___ _ _| _ \__ _(_)_ _ ___
+	//     |  _| | |  _/ -_) '_|  _/ _` | | '_(_-<
+	//     |_| |_|_|\__\___|_| |_| \__,_|_|_| /__/
+	//                                            
+	// Run the SIMD rejection test on pairs [begin, end) and store which ones might overlap in pairMightOverlap
+	/* Only reads positions, so chunks of the pair list can be filtered in parallel before any response runs.
+	   Batches that aren't all circle pairs keep the 1 mergePairs filled in and always go to their response.
+	   With verifySimd every pair the filter rejects also gets the exact test CircleCircleCollisionResponse makes, a pair
+	   that overlaps after all is a mismatch. The filter runs in either mode while verifying, but pairMightOverlap is only
+	   read in NARROWPHASE_SIMD, so verifying never changes what the scalar mode does.
+	   For the colored solve the circle pairs that get past the filter are tested exactly as well, only pairs touching at
+	   the start of the step get a color. The SIMD test never rejects a touching pair, so both modes end up with the same colors.
+	   Every pair also gets the gap between its surfaces for the contact cache */
+	void filterPairs(int begin, int end)
+	{
+		for (int p = begin; p < end; p++) {
+			pairSeparation[p] = pairGap(pairs[p]);
+		}
+
+		if (narrowphaseMode == NARROWPHASE_SIMD || verifySimd)
+		{
+			for (int p = begin; p + NARROWPHASE_LANES <= end; p += NARROWPHASE_LANES) {
+				if (!isCircleBatch(p)) continue;
+				unsigned int mask = CircleCircleOverlapMask(bodies, &pairs[p]);
+				for (int lane = 0; lane < NARROWPHASE_LANES; lane++) {
+					pairMightOverlap[p + lane] = (mask >> lane) & 1;
+					if (verifySimd && !pairMightOverlap[p + lane] && circlesOverlap(pairs[p + lane])) narrowphaseMismatches++;
+				}
+			}
+		}
+		if (!coloredSolve) return;
+		for (int p = begin; p < end; p++) {
+			collisionPair pair = pairs[p];
+			bool touching = true; // Halfspace pairs always get a color
+			if (bodies.flags[pair.a] & bodies.flags[pair.b] & BODY_CIRCLE)
+			{
+				float sumOfRadii = bodies.radius[pair.a] + bodies.radius[pair.b];
+				bool mightOverlap = (narrowphaseMode != NARROWPHASE_SIMD) || pairMightOverlap[p];
+				touching = mightOverlap && Vector2DistanceSqr(bodies.getPosition(pair.a), bodies.getPosition(pair.b)) < sumOfRadii * sumOfRadii;
+			}
+			pairTouching[p] = touching;
+		}
+	}
+
+	// True if CircleCircleCollisionResponse would push the circles of pair apart, the same sums in the same order
+	bool circlesOverlap(collisionPair pair)
+	{
+		float distance = Vector2Length(Vector2Subtract(bodies.getPosition(pair.b), bodies.getPosition(pair.a)));
+		return bodies.radius[pair.a] + bodies.radius[pair.b] - distance > 0;
+	}
+
+	// Distance between the surfaces of a pair, negative while they overlap. Far pairs skip the square root and just return contactHysteresis
+	float pairGap(collisionPair pair)
+	{
+		if (bodies.flags[pair.a] & bodies.flags[pair.b] & BODY_CIRCLE)
+		{
+			float sumOfRadii = bodies.radius[pair.a] + bodies.radius[pair.b];
+			float reach = sumOfRadii + contactHysteresis;
+			float distanceSqr = Vector2DistanceSqr(bodies.getPosition(pair.a), bodies.getPosition(pair.b));
+			if (!(distanceSqr < reach * reach)) return contactHysteresis;
+			return sqrtf(distanceSqr) - sumOfRadii;
+		}
+		int circle = (bodies.flags[pair.a] & BODY_CIRCLE) ? pair.a : pair.b;
+		int plane = (circle == pair.a) ? pair.b : pair.a;
+		Vector2 normal = ((physicsHalfspace*)objects[plane])->getNormal();
+		return Vector2DotProduct(bodies.getPosition(circle) - bodies.getPosition(plane), normal) - bodies.radius[circle];
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//               __            _    ___         _           _      
+	//      _ _ ___ / _|_ _ ___ __| |_ / __|___ _ _| |_ __ _ __| |_ ___
+	//     | '_/ -_)  _| '_/ -_|_-< ' \ (__/ _ \ ' \  _/ _` / _|  _(_-<
+	//     |_| \___|_| |_| \___/__/_||_\___\___/_||_\__\__,_\__|\__/__/
+	//                                                                 
+	// Match this step's close pairs with the contacts cached last step, contacts found again keep their impulses
+	/* Every pair closer than contactHysteresis gets a contact, so a contact that separates by a pixel for a step or two
+	   isn't thrown away and rebuilt from zero. Both lists are sorted by key and walked together, no hashing, and the
+	   result is the same on any number of threads. Sleeping pairs aren't gathered, their contacts are kept as they are
+	   until the bodies wake or are removed. Brute force doesn't build a pair list, so it only keeps the sleeping ones */
+	void refreshContacts()
+	{
+		freshContacts.clear();
+		pairCache.assign(pairs.size(), -1);
+		for (int p = 0; p < pairs.size(); p++) {
+			if (pairSeparation[p] >= contactHysteresis) continue;
+			unsigned int slotA = bodies.handle[pairs[p].a];
+			unsigned int slotB = bodies.handle[pairs[p].b];
+			if (slotA > slotB) swap(slotA, slotB);
+			cachedContact contact = {};
+			contact.key = ((unsigned long long)slotA << 32) | slotB;
+			contact.a = { slotA, handleGeneration[slotA] };
+			contact.b = { slotB, handleGeneration[slotB] };
+			contact.separation = pairSeparation[p];
+			contact.pair = p;
+			freshContacts.push_back(contact);
+		}
+		for (cachedContact& contact : contactCache) {
+			int a = indexOf(contact.a);
+			int b = indexOf(contact.b);
+			if (a == -1 || b == -1 || !bodies.isResting(a, b)) continue; // Removed, or awake and far enough apart to not be a pair anymore
+			contact.pair = -1;
+			freshContacts.push_back(contact);
+		}
+		sort(freshContacts.begin(), freshContacts.end(), [](const cachedContact& x, const cachedContact& y) { return x.key < y.key; });
+
+		persistentContacts = 0;
+		int old = 0;
+		for (cachedContact& contact : freshContacts) {
+			while (old < contactCache.size() && contactCache[old].key < contact.key) old++;
+			if (contact.pair == -1) continue; // Kept while asleep, already has its impulses
+			if (old < contactCache.size() && contactCache[old].a == contact.a && contactCache[old].b == contact.b)
+			{
+				contact.normalImpulse = contactCache[old].normalImpulse;
+				contact.tangentImpulse = contactCache[old].tangentImpulse;
+				contact.age = contactCache[old].age + 1;
+				persistentContacts++;
+			}
+		}
+		contactCache.swap(freshContacts);
+		for (int k = 0; k < contactCache.size(); k++) {
+			if (contactCache[k].pair != -1) pairCache[contactCache[k].pair] = k;
+		}
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//              _         ___                 _            
+	//      ___ ___| |_ _____|_ _|_ __  _ __ _  _| |___ ___ ___
+	//     (_-</ _ \ \ V / -_)| || '  \| '_ \ || | (_-</ -_|_-<
+	//     /__/\___/_|\_/\___|___|_|_|_| .__/\_,_|_/__/\___/__/
+	//                                 |_|                     
+	// Resolve every cached contact on the velocities, solverIterations passes of sequential impulses
+	/* Each contact pushes its two bodies apart along the normal until they stop closing in (accumulated normal impulse >= 0),
+	   and friction pushes along the tangent up to friction * normal impulse (Coulomb). Overlap is fed back as extra
+	   separating velocity (Baumgarte), contacts that are still apart may close the gap but not more (speculative),
+	   and contacts closing fast enough bounce with restitution. Circles don't spin in this simulation, so a contact only
+	   changes linear velocity.
+	   Contacts come from the cache in key order and are solved one after another on one thread, so the result doesn't
+	   depend on the workers. With warm starting each contact starts from last step's impulses, a resting pile is already
+	   almost solved before the first iteration */
+	void solveImpulses()
+	{
+		pairTests = (unsigned int)pairs.size();
+		float* vx = bodies.velocityX.data();
+		float* vy = bodies.velocityY.data();
+		const float* im = bodies.inverseMass.data();
+
+		constraints.clear();
+		for (int k = 0; k < contactCache.size(); k++) {
+			cachedContact& cached = contactCache[k];
+			if (cached.pair == -1) continue; // Sleeping
+			contactConstraint contact;
+			contact.a = pairs[cached.pair].a;
+			contact.b = pairs[cached.pair].b;
+			if (bodies.flags[contact.b] & BODY_HALFSPACE) swap(contact.a, contact.b);
+			float inverseMassSum = im[contact.a] + im[contact.b];
+			if (inverseMassSum == 0.0f) continue; // Neither body can move
+			contact.cache = k;
+			if (bodies.flags[contact.a] & BODY_HALFSPACE) contact.normal = ((physicsHalfspace*)objects[contact.a])->getNormal();
+			else
+			{
+				Vector2 displacement = bodies.getPosition(contact.b) - bodies.getPosition(contact.a);
+				float distance = Vector2Length(displacement);
+				contact.normal = (distance > 0) ? displacement / distance : Vector2{ 0, -1 }; // On top of each other, same direction the position solver picks
+			}
+			contact.normalMass = 1.0f / inverseMassSum;
+			contact.friction = bodies.grip[contact.a] * bodies.grip[contact.b];
+
+			float separation = cached.separation;
+			float closingSpeed = Vector2DotProduct(bodies.getVelocity(contact.b) - bodies.getVelocity(contact.a), contact.normal);
+			if (separation > 0) contact.velocityBias = separation / dt; // Apart, only stop them from closing more than the gap this step
+			else
+			{
+				contact.velocityBias = -min(baumgarte * max(-separation - penetrationSlop, 0.0f) / dt, maxCorrectionSpeed);
+				if (closingSpeed < -restitutionThreshold) contact.velocityBias = min(contact.velocityBias, restitution * closingSpeed);
+			}
+
+			if (warmStarting)
+			{
+				Vector2 tangent = { -contact.normal.y, contact.normal.x };
+				Vector2 impulse = contact.normal * cached.normalImpulse + tangent * cached.tangentImpulse;
+				vx[contact.a] -= impulse.x * im[contact.a];
+				vy[contact.a] -= impulse.y * im[contact.a];
+				vx[contact.b] += impulse.x * im[contact.b];
+				vy[contact.b] += impulse.y * im[contact.b];
+			}
+			else
+			{
+				cached.normalImpulse = 0;
+				cached.tangentImpulse = 0;
+			}
+			constraints.push_back(contact);
+		}
+
+		for (int iteration = 0; iteration < solverIterations; iteration++) {
+			for (contactConstraint& contact : constraints) {
+				cachedContact& cached = contactCache[contact.cache];
+				int a = contact.a;
+				int b = contact.b;
+				Vector2 tangent = { -contact.normal.y, contact.normal.x };
+
+				// Friction first, limited by the normal impulse from the last pass
+				Vector2 relativeVelocity = { vx[b] - vx[a], vy[b] - vy[a] };
+				float maxFriction = contact.friction * cached.normalImpulse;
+				float tangentImpulse = Clamp(cached.tangentImpulse - Vector2DotProduct(relativeVelocity, tangent) * contact.normalMass, -maxFriction, maxFriction);
+				Vector2 impulse = tangent * (tangentImpulse - cached.tangentImpulse);
+				cached.tangentImpulse = tangentImpulse;
+
+				// Normal, the total can only ever push the bodies apart
+				relativeVelocity = relativeVelocity + impulse * (im[a] + im[b]);
+				float normalImpulse = max(cached.normalImpulse - (Vector2DotProduct(relativeVelocity, contact.normal) + contact.velocityBias) * contact.normalMass, 0.0f);
+				impulse = impulse + contact.normal * (normalImpulse - cached.normalImpulse);
+				cached.normalImpulse = normalImpulse;
+
+				vx[a] -= impulse.x * im[a];
+				vy[a] -= impulse.y * im[a];
+				vx[b] += impulse.x * im[b];
+				vy[b] += impulse.y * im[b];
+			}
+		}
+
+		for (contactConstraint& contact : constraints) {
+			cachedContact& cached = contactCache[contact.cache];
+			if (cached.normalImpulse <= 0.0f) continue;
+			markContact(pairs[cached.pair]); // Pushing on each other, counts as touching for colors and islands
+			Vector2 point = bodies.getPosition(contact.b) - contact.normal * bodies.radius[contact.b];
+			if (debugDraw.wants(DEBUG_NORMAL)) debugDraw.addVector(point, contact.normal * (cached.normalImpulse / dt), 1, GREEN); // As forces, like the position solver draws them
+			if (debugDraw.wants(DEBUG_FRICTION)) debugDraw.addVector(point, Vector2{ -contact.normal.y, contact.normal.x } * (cached.tangentImpulse / dt), 2, ORANGE);
+		}
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//              _         ___      _       _               
+	//      ___ ___| |_ _____/ __|_  _| |__ __| |_ ___ _ __ ___
+	//     (_-</ _ \ \ V / -_)__ \ || | '_ (_-<  _/ -_) '_ (_-<
+	//     /__/\___/_|\_/\___|___/\_,_|_.__/__/\__\___| .__/__/
+	//                                                |_|      
+	// Step with substeps short steps of extended position based dynamics (XPBD): predict, project the contacts, derive the velocities
+	/* Each substep of h = dt / substeps moves every body with gravity, drag and the collected forces (predict), pushes
+	   overlapping pairs apart along their normals weighted by inverse mass (project), then sets the velocity to how far the
+	   body actually went divided by h (derive). The velocity change from a contact falls out of the position change, so there
+	   is no restitution or Baumgarte tuning, and many cheap substeps stiffen a pile better than more iterations would.
+	   Friction undoes the sideways slip of a substep up to friction * normal correction (Coulomb, in position form).
+	   The pair list is only built once per step: substepPairs keeps the pairs that could close their gap within the step
+	   with the speed they start with, plus substepMargin. Overlap a pair already had at the start of the step (circles
+	   spawned on top of each other) is pushed out at no more than maxCorrectionSpeed, otherwise the velocity derived from
+	   the correction would fire them apart. Contacts are projected in pair order on one thread, so the
+	   result doesn't depend on the workers; predict and derive are parallel fors over the bodies */
+	void solveSubsteps()
+	{
+		pairTests = (unsigned int)pairs.size();
+		float h = dt / substeps;
+		float stepCompliance = contactCompliance / (h * h); // Scaled to the substep, the alpha tilde of XPBD
+		float gravityStep = Vector2Length(gravityAcceleration) * dt * dt;
+
+		substepPairs.clear();
+		for (int p = 0; p < pairs.size(); p++) {
+			int a = pairs[p].a;
+			int b = pairs[p].b;
+			float closing = (Vector2Length(bodies.getVelocity(a)) + Vector2Length(bodies.getVelocity(b))) * dt + gravityStep + substepMargin;
+			if (bodies.flags[a] & bodies.flags[b] & BODY_CIRCLE)
+			{
+				float reach = bodies.radius[a] + bodies.radius[b] + closing;
+				if (Vector2DistanceSqr(bodies.getPosition(a), bodies.getPosition(b)) < reach * reach) substepPairs.push_back(p);
+			}
+			else if (pairGap(pairs[p]) < closing) substepPairs.push_back(p);
+		}
+		pairNormalLambda.assign(substepPairs.size(), 0);
+		pairTangentLambda.assign(substepPairs.size(), 0);
+		pairOverlapAllowance.resize(substepPairs.size());
+		for (int k = 0; k < substepPairs.size(); k++) {
+			pairOverlapAllowance[k] = max(-pairSeparation[substepPairs[k]], 0.0f);
+		}
+		substepStartX.resize(bodies.size());
+		substepStartY.resize(bodies.size());
+
+		float* px = bodies.positionX.data();
+		float* py = bodies.positionY.data();
+		float* vx = bodies.velocityX.data();
+		float* vy = bodies.velocityY.data();
+		const float* im = bodies.inverseMass.data();
+		for (int substep = 0; substep < substeps; substep++) {
+			for (float& allowance : pairOverlapAllowance) {
+				allowance = max(allowance - maxCorrectionSpeed * h, 0.0f);
+			}
+
+			// Predict
+			jobs.parallelFor(bodies.size(), BODY_GRAIN, [&](int begin, int end) {
+				for (int i = begin; i < end; i++) {
+					substepStartX[i] = px[i];
+					substepStartY[i] = py[i];
+					if (im[i] == 0.0f) continue;
+					vx[i] += ((bodies.forceX[i] - bodies.drag[i] * vx[i]) * im[i] + gravityAcceleration.x) * h;
+					vy[i] += ((bodies.forceY[i] - bodies.drag[i] * vy[i]) * im[i] + gravityAcceleration.y) * h;
+					px[i] += vx[i] * h;
+					py[i] += vy[i] * h;
+				}
+			});
+
+			// Project
+			for (int k = 0; k < substepPairs.size(); k++) {
+				collisionPair pair = pairs[substepPairs[k]];
+				int a = pair.a;
+				int b = pair.b;
+				if (bodies.flags[b] & BODY_HALFSPACE) swap(a, b);
+				float inverseMassSum = im[a] + im[b];
+				if (inverseMassSum == 0.0f) continue;
+
+				Vector2 normal; // From a to b
+				float separation;
+				if (bodies.flags[a] & BODY_HALFSPACE)
+				{
+					normal = ((physicsHalfspace*)objects[a])->getNormal();
+					separation = Vector2DotProduct(bodies.getPosition(b) - bodies.getPosition(a), normal) - bodies.radius[b];
+				}
+				else
+				{
+					Vector2 displacement = bodies.getPosition(b) - bodies.getPosition(a);
+					float distance = Vector2Length(displacement);
+					normal = (distance > 0) ? displacement / distance : Vector2{ 0, -1 }; // On top of each other, same direction the position solver picks
+					separation = distance - bodies.radius[a] - bodies.radius[b];
+				}
+				float depth = -separation - pairOverlapAllowance[k];
+				if (depth <= 0) continue;
+
+				float normalLambda = depth / (inverseMassSum + stepCompliance);
+				Vector2 correction = normal * normalLambda;
+
+				// Sideways slip this substep, cancelled up to the friction limit
+				Vector2 slip = { (px[b] + correction.x * im[b] - substepStartX[b]) - (px[a] - correction.x * im[a] - substepStartX[a]),
+					(py[b] + correction.y * im[b] - substepStartY[b]) - (py[a] - correction.y * im[a] - substepStartY[a]) };
+				Vector2 tangent = { -normal.y, normal.x };
+				float tangentSlip = Vector2DotProduct(slip, tangent);
+				float maxFriction = bodies.grip[a] * bodies.grip[b] * normalLambda;
+				float tangentLambda = Clamp(-tangentSlip / inverseMassSum, -maxFriction, maxFriction);
+				correction = correction + tangent * tangentLambda;
+
+				px[a] -= correction.x * im[a];
+				py[a] -= correction.y * im[a];
+				px[b] += correction.x * im[b];
+				py[b] += correction.y * im[b];
+				pairNormalLambda[k] += normalLambda;
+				pairTangentLambda[k] += tangentLambda;
+			}
+
+			// Derive velocities
+			jobs.parallelFor(bodies.size(), BODY_GRAIN, [&](int begin, int end) {
+				for (int i = begin; i < end; i++) {
+					if (im[i] == 0.0f) continue;
+					vx[i] = (px[i] - substepStartX[i]) / h;
+					vy[i] = (py[i] - substepStartY[i]) / h;
+				}
+			});
+		}
+
+		for (int i = 0; i < bodies.size(); i++) {
+			bodies.forceX[i] = 0.0f;
+			bodies.forceY[i] = 0.0f;
+		}
+		for (int k = 0; k < substepPairs.size(); k++) {
+			if (pairNormalLambda[k] <= 0.0f) continue;
+			collisionPair pair = pairs[substepPairs[k]];
+			markContact(pair); // Pushed apart in some substep, counts as touching for colors and islands
+			if (!debugDraw.wants(DEBUG_NORMAL | DEBUG_FRICTION)) continue;
+			int a = pair.a;
+			int b = pair.b;
+			if (bodies.flags[b] & BODY_HALFSPACE) swap(a, b);
+			Vector2 normal = (bodies.flags[a] & BODY_HALFSPACE) ? ((physicsHalfspace*)objects[a])->getNormal()
+				: Vector2Normalize(bodies.getPosition(b) - bodies.getPosition(a));
+			Vector2 point = bodies.getPosition(b) - normal * bodies.radius[b];
+			float toForce = 1.0f / (h * dt); // Position correction per substep is force * h^2, averaged over the step
+			if (debugDraw.wants(DEBUG_NORMAL)) debugDraw.addVector(point, normal * (pairNormalLambda[k] * toForce), 1, GREEN);
+			if (debugDraw.wants(DEBUG_FRICTION)) debugDraw.addVector(point, Vector2{ -normal.y, normal.x } * (pairTangentLambda[k] * toForce), 2, ORANGE);
+		}
+	}
+
+	// True if this step goes through solveImpulses, brute force has no pair list for the contact cache so it stays on the position solver
+	bool usingImpulses() { return solver == SOLVER_IMPULSE && broadphase != BROADPHASE_BRUTE_FORCE; }
+
+	// True if this step goes through solveSubsteps, which needs the pair list as well
+	bool usingSubsteps() { return solver == SOLVER_SUBSTEP && broadphase != BROADPHASE_BRUTE_FORCE; }
+
+	// Cache entry of pairs[p], nullptr if it doesn't have one
+	cachedContact* contactFor(int p)
+	{
+		return pairCache[p] == -1 ? nullptr : &contactCache[pairCache[p]];
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//                                        _                 
+	//      _ _  __ _ _ _ _ _ _____ __ ___ __| |_  __ _ ___ ___ 
+	//     | ' \/ _` | '_| '_/ _ \ V  V / '_ \ ' \/ _` (_-</ -_)
+	//     |_||_\__,_|_| |_| \___/\_/\_/| .__/_||_\__,_/__/\___|
+	//                                  |_|                     
+	// Send every pair the broadphase found to its collision response, in order, or color by color when coloredSolve is on
+	void narrowphase()
+	{
+		pairTests = (unsigned int)pairs.size();
+		if (coloredSolve)
+		{
+			solveColors();
+			return;
+		}
+		for (int p = 0; p < pairs.size(); p++) {
+			if (mightTouch(p) && collidePair(pairs[p].a, pairs[p].b, contactFor(p))) markContact(pairs[p]);
+		}
+	}
+
+	// True if pair p has to go to its collision response
+	bool mightTouch(int p)
+	{
+		collisionPair pair = pairs[p];
+		if (narrowphaseMode == NARROWPHASE_SCALAR || pairMightOverlap[p]) return true;
+		// The filter ran before any response, if a body in this pair has been pushed since then retest it
+		return ((bodies.flags[pair.a] | bodies.flags[pair.b]) & BODY_COLLIDED) != 0;
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//             _         ___      _        
+	//      __ ___| |___ _ _| _ \__ _(_)_ _ ___
+	//     / _/ _ \ / _ \ '_|  _/ _` | | '_(_-<
+	//     \__\___/_\___/_| |_| \__,_|_|_| /__/
+	//                                         
+	// Sort the pairs touching at the start of the step into colors, no object that a response writes to shows up twice in one color
+	/* Greedy: walking the pairs in order, each pair takes the lowest color neither of its objects has been given yet.
+	   Halfspaces are only read by their response, so they don't take up colors and can be in every pair of a color.
+	   Pairs that can't get one of the MAX_COLORS colors go in the overflow bucket (colorOffsets[MAX_COLORS]) and are solved
+	   one at a time at the end. The colors only depend on the pair list, never on threads */
+	void colorPairs()
+	{
+		colorOffsets.assign(MAX_COLORS + 2, 0);
+		colorCount = 0;
+		if (!coloredSolve || usingImpulses() || usingSubsteps()) return;
+
+		bodyColors.assign(bodies.size(), 0);
+		pairColor.resize(pairs.size());
+		int touchingCount = 0;
+		for (int p = 0; p < pairs.size(); p++) {
+			if (!pairTouching[p]) continue;
+			touchingCount++;
+			int a = pairs[p].a;
+			int b = pairs[p].b;
+			bool writesA = !(bodies.flags[a] & BODY_HALFSPACE);
+			bool writesB = !(bodies.flags[b] & BODY_HALFSPACE);
+			unsigned long long used = (writesA ? bodyColors[a] : 0) | (writesB ? bodyColors[b] : 0); // Bit c set if color c is taken
+			int color = 0;
+			while (color < MAX_COLORS && (used & (1ull << color))) color++;
+			if (color < MAX_COLORS)
+			{
+				if (writesA) bodyColors[a] |= 1ull << color;
+				if (writesB) bodyColors[b] |= 1ull << color;
+				colorCount = max(colorCount, color + 1);
+			}
+			pairColor[p] = color;
+			colorOffsets[color + 1]++;
+		}
+
+		// Counting sort by color, pairs keep their order inside a color
+		for (int color = 0; color <= MAX_COLORS; color++) {
+			colorOffsets[color + 1] += colorOffsets[color];
+		}
+		colorFill.assign(colorOffsets.begin(), colorOffsets.end() - 1);
+		coloredPairs.resize(touchingCount);
+		for (int p = 0; p < pairs.size(); p++) {
+			if (pairTouching[p]) coloredPairs[colorFill[pairColor[p]]++] = p;
+		}
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//              _          ___     _            
+	//      ___ ___| |_ _____ / __|___| |___ _ _ ___
+	//     (_-</ _ \ \ V / -_) (__/ _ \ / _ \ '_(_-<
+	//     /__/\___/_|\_/\___|\___\___/_\___/_| /__/
+	//                                              
+	// Run the collision responses one color at a time, the pairs of a color are spread over every worker
+	/* Inside a color no two pairs write the same object, so they can't race and the order they run in doesn't change
+	   anything. The result only depends on the colors, it's the same on any number of threads (but not the same as the
+	   single pair order of narrowphase(), objects get pushed in a different order, and pairs that only start touching
+	   after a push are left for the next step).
+	   A halfspace can be in every pair of a color, so its BODY_COLLIDED flag is set afterwards from pairContact */
+	void solveColors()
+	{
+		pairContact.assign(pairs.size(), 0);
+		for (int color = 0; color < colorCount; color++) {
+			int first = colorOffsets[color];
+			jobs.parallelFor(colorOffsets[color + 1] - first, PAIR_GRAIN, [&](int begin, int end) {
+				for (int k = first + begin; k < first + end; k++) {
+					collisionPair pair = pairs[coloredPairs[k]];
+					if (!collidePair(pair.a, pair.b, contactFor(coloredPairs[k]))) continue;
+					if (!(bodies.flags[pair.a] & BODY_HALFSPACE)) bodies.flags[pair.a] |= BODY_COLLIDED;
+					if (!(bodies.flags[pair.b] & BODY_HALFSPACE)) bodies.flags[pair.b] |= BODY_COLLIDED;
+					pairContact[coloredPairs[k]] = 1;
+				}
+			});
+		}
+		for (int k = 0; k < colorOffsets[MAX_COLORS]; k++) {
+			if (pairContact[coloredPairs[k]]) markContact(pairs[coloredPairs[k]]);
+		}
+
+		// Overflow, one pair at a time
+		for (int k = colorOffsets[MAX_COLORS]; k < colorOffsets[MAX_COLORS + 1]; k++) {
+			collisionPair pair = pairs[coloredPairs[k]];
+			if (collidePair(pair.a, pair.b, contactFor(coloredPairs[k]))) markContact(pair);
+		}
+	}
+
+	// True if the batch starting at pairs[first] is all circle-circle pairs
+	bool isCircleBatch(int first)
+	{
+		for (int lane = 0; lane < NARROWPHASE_LANES; lane++) {
+			if (!(bodies.flags[pairs[first + lane].a] & bodies.flags[pairs[first + lane].b] & BODY_CIRCLE)) return false;
+		}
+		return true;
+	}
+
+	void markContact(collisionPair pair)
+	{
+		bodies.flags[pair.a] |= BODY_COLLIDED;
+		bodies.flags[pair.b] |= BODY_COLLIDED;
+		contactCount++;
+		contacts.push_back(pair);
+	}
+
+	// Remember where objects [begin, end) start this step, drawing blends from there to where the step leaves them
+	void storePreviousPositions(int begin, int end)
+	{
+		memcpy(&bodies.previousX[begin], &bodies.positionX[begin], (end - begin) * sizeof(float));
+		memcpy(&bodies.previousY[begin], &bodies.positionY[begin], (end - begin) * sizeof(float));
+	}
+
+	// Clear BODY_COLLIDED on objects [begin, end), the flag tracks which objects have collided this step
+	void clearContacts(int begin, int end)
+	{
+		for (int i = begin; i < end; i++) {
+			bodies.flags[i] &= ~BODY_COLLIDED;
+		}
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//      _         _ _    _ ___                  _      _                 
+	//     | |__ _  _(_) |__| | _ )_ _ ___  __ _ __| |_ __| |_  __ _ ___ ___ 
+	//     | '_ \ || | | / _` | _ \ '_/ _ \/ _` / _` | '_ \ ' \/ _` (_-</ -_)
+	//     |_.__/\_,_|_|_\__,_|___/_| \___/\__,_\__,_| .__/_||_\__,_/__/\___|
+	//                                               |_|                     
+	// Rebuild the grid or refit the tree for this step, gatherPairs reads it from every worker afterwards
+	void buildBroadphase()
+	{
+		pairTests = 0;
+		contactCount = 0;
+		contacts.clear();
+		if (broadphase == BROADPHASE_BRUTE_FORCE) return;
+
+		if (broadphase == BROADPHASE_GRID) grid.build(bodies);
+		else updateTree();
+		unbounded.clear();
+		for (int i = 0; i < bodies.size(); i++) {
+			if (!(bodies.flags[i] & BODY_CIRCLE)) unbounded.push_back(i);
+		}
+		pairChunks.resize((bodies.size() + BODY_GRAIN - 1) / BODY_GRAIN);
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//                _   _            ___      _        
+	//      __ _ __ _| |_| |_  ___ _ _| _ \__ _(_)_ _ ___
+	//     / _` / _` |  _| ' \/ -_) '_|  _/ _` | | '_(_-<
+	//     \__, \__,_|\__|_||_\___|_| |_| \__,_|_|_| /__/
+	//     |___/                                         
+	// Collect the candidate pairs of objects [begin, end) into their own pairChunk
+	// Candidates only depend on the grid or tree, which don't change until next step, so every chunk can be gathered at once
+	void gatherPairs(int begin, int end)
+	{
+		if (broadphase == BROADPHASE_BRUTE_FORCE) return;
+		pairChunk& chunk = pairChunks[begin / BODY_GRAIN];
+		chunk.pairs.clear();
+		for (int i = begin; i < end; i++) {
+			if (broadphase == BROADPHASE_GRID) findGridPairs(i, chunk.candidates);
+			else findTreePairs(i, chunk.candidates, chunk.stack);
+			for (int j : chunk.candidates) {
+				if (!bodies.isResting(i, j)) chunk.pairs.push_back({ i, j }); // Sleeping bodies only need checking against awake ones
+			}
+		}
+	}
+
+	// Join the chunks in order, so pairs ends up in the same order a single thread would have found them
+	void mergePairs()
+	{
+		pairs.clear();
+		if (broadphase != BROADPHASE_BRUTE_FORCE)
+		{
+			for (pairChunk& chunk : pairChunks) {
+				pairs.insert(pairs.end(), chunk.pairs.begin(), chunk.pairs.end());
+			}
+		}
+		pairMightOverlap.assign(pairs.size(), 1);
+		pairTouching.resize(pairs.size());
+		narrowphaseMismatches = 0; // filterPairs counts them again
+		pairSeparation.resize(pairs.size());
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//                      _          ___         _           _      
+	//      _ _ ___ ___ ___| |_ _____ / __|___ _ _| |_ __ _ __| |_ ___
+	//     | '_/ -_|_-</ _ \ \ V / -_) (__/ _ \ ' \  _/ _` / _|  _(_-<
+	//     |_| \___/__/\___/_|\_/\___|\___\___/_||_\__\__,_\__|\__/__/
+	//                                                                
+	// Run the collision responses, one pair after another since each response moves objects the next pair may be looking at
+	// (or color by color, see solveColors). Brute force always goes in order, it's the reference the others are compared to
+	void resolveContacts()
+	{
+		if (verifySimd && narrowphaseMismatches > 0) TraceLog(LOG_WARNING, "NARROWPHASE: SIMD filter rejected %i overlapping pairs", narrowphaseMismatches.load());
+		if (broadphase == BROADPHASE_BRUTE_FORCE)
+		{
+			for (int i = 0; i < bodies.size(); i++) {
+				for (int j = i + 1; j < bodies.size(); j++) { // Start checking from the next object, no need to check previous objects again
+					if (bodies.isResting(i, j)) continue; // Sleeping bodies only need checking against awake ones
+					// Mark objects as collided if a collision occurred
+					pairTests++;
+					if (collidePair(i, j)) markContact({ i, j });
+				}
+			}
+		}
+		else if (usingImpulses()) solveImpulses();
+		else if (usingSubsteps()) solveSubsteps();
+		else narrowphase();
+	}
+
+	// Update object colors [begin, end) based on collision status
+	void updateColors(int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			if (bodies.flags[i] & BODY_COLLIDED)
+			{
+				bodies.color[i] = RED;
+			}
+			else if (bodies.flags[i] & BODY_ASLEEP)
+			{
+				bodies.color[i] = DARKGREEN;
+			}
+			else
+			{
+				bodies.color[i] = GREEN;
+			}
+		}
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//                    _      _       ___ _              
+	//      _  _ _ __  __| |__ _| |_ ___/ __| |___ ___ _ __ 
+	//     | || | '_ \/ _` / _` |  _/ -_)__ \ / -_) -_) '_ \
+	//      \_,_| .__/\__,_\__,_|\__\___|___/_\___\___| .__/
+	//          |_|                                   |_|   
+	// Put islands of resting bodies to sleep, and wake sleeping islands that something awake touched this step
+	/* Islands are the groups of moving bodies connected by contacts, static bodies (halfspaces) don't join islands together.
+	   A body rests while it moves slower than sleepSpeed, measured from how far it actually went this step rather than
+	   its velocity, since a circle sitting on another one keeps the velocity gravity gives it and only gets pushed back.
+	   An island sleeps once every body has rested for sleepTime and its energy per body is under sleepEnergy.
+	   Sleeping bodies don't move, get no forces and their pairs with other resting bodies are never gathered.
+	   Runs on one thread after integrate(), contacts are in pair order so the result doesn't depend on the workers */
+	void updateSleep()
+	{
+		int count = bodies.size();
+		sleepingCount = 0;
+
+		// Gravity or a halfspace changed, what the sleeping bodies were resting on isn't true anymore
+		vector<float> watch = { gravityAcceleration.x, gravityAcceleration.y };
+		for (int i = 0; i < count; i++) {
+			if (!(bodies.flags[i] & BODY_HALFSPACE)) continue;
+			physicsHalfspace* plane = (physicsHalfspace*)objects[i];
+			watch.insert(watch.end(), { bodies.positionX[i], bodies.positionY[i], plane->getNormal().x, plane->getNormal().y, bodies.grip[i] });
+		}
+		if (watch != wakeWatch || !allowSleep) wakeAll();
+		wakeWatch = watch;
+		if (!allowSleep) return;
+
+		// Something awake touched a sleeping body, wake its whole island
+		wakingIslands.clear();
+		for (collisionPair pair : contacts) {
+			bool asleepA = bodies.flags[pair.a] & BODY_ASLEEP;
+			bool asleepB = bodies.flags[pair.b] & BODY_ASLEEP;
+			if (asleepA && !asleepB) wakingIslands.push_back(bodies.island[pair.a]);
+			if (asleepB && !asleepA) wakingIslands.push_back(bodies.island[pair.b]);
+		}
+		if (!wakingIslands.empty())
+		{
+			sort(wakingIslands.begin(), wakingIslands.end());
+			for (int i = 0; i < count; i++) {
+				if ((bodies.flags[i] & BODY_ASLEEP) && binary_search(wakingIslands.begin(), wakingIslands.end(), bodies.island[i])) bodies.wake(i);
+			}
+		}
+
+		// Rest timers
+		for (int i = 0; i < count; i++) {
+			if (bodies.flags[i] & (BODY_STATIC | BODY_ASLEEP)) continue;
+			float moved = Vector2DistanceSqr(bodies.getPosition(i), bodies.getPreviousPosition(i));
+			if (moved < sleepSpeed * sleepSpeed * dt * dt) bodies.sleepTimer[i] += dt;
+			else bodies.sleepTimer[i] = 0;
+		}
+
+		// Join moving bodies that touched into islands
+		islandParent.resize(count);
+		for (int i = 0; i < count; i++) {
+			islandParent[i] = i;
+		}
+		for (collisionPair pair : contacts) {
+			if ((bodies.flags[pair.a] | bodies.flags[pair.b]) & (BODY_STATIC | BODY_ASLEEP)) continue;
+			int rootA = findIsland(pair.a);
+			int rootB = findIsland(pair.b);
+			if (rootA != rootB) islandParent[max(rootA, rootB)] = min(rootA, rootB); // Lowest slot is the root, so roots don't depend on contact order
+		}
+
+		islandTimer.assign(count, sleepTime);
+		islandEnergy.assign(count, 0);
+		islandSize.assign(count, 0);
+		islandLabel.assign(count, 0);
+		for (int i = 0; i < count; i++) {
+			if (bodies.flags[i] & (BODY_STATIC | BODY_ASLEEP)) continue;
+			int root = findIsland(i);
+			Vector2 motion = (bodies.getPosition(i) - bodies.getPreviousPosition(i)) / dt;
+			islandTimer[root] = min(islandTimer[root], bodies.sleepTimer[i]);
+			islandEnergy[root] += 0.5f * bodies.mass[i] * Vector2DotProduct(motion, motion);
+			islandSize[root]++;
+		}
+
+		// Islands that have rested long enough go to sleep
+		for (int i = 0; i < count; i++) {
+			if (bodies.flags[i] & BODY_STATIC) continue;
+			if (!(bodies.flags[i] & BODY_ASLEEP))
+			{
+				int root = findIsland(i);
+				if (islandTimer[root] < sleepTime || islandEnergy[root] > sleepEnergy * islandSize[root]) continue;
+				if (islandLabel[root] == 0) islandLabel[root] = ++islandCount;
+				bodies.island[i] = islandLabel[root];
+				bodies.sleep(i);
+			}
+			sleepingCount++;
+		}
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//                             ___        _   ___          _ _        
+	//      ____ __ _____ ___ _ __| __|_ _ __| |_| _ ) ___  __| (_)___ ___
+	//     (_-< V  V / -_) -_) '_ \ _/ _` (_-<  _| _ \/ _ \/ _` | / -_|_-<
+	//     /__/\_/\_/\___\___| .__/_|\__,_/__/\__|___/\___/\__,_|_\___/__/
+	//                       |_|                                          
+	// Sweep every circle that integrate moved further than ccdMotionFraction of its radius, from where it was to where it ended up
+	/* A small fast circle can go further than its own diameter in one step and end up past a thin body or the halfspace
+	   without ever overlapping it. The sweep finds the first time of impact along the path, against the halfspaces and
+	   against the other circles where they ended the step (treated as still, the same as Box2D does for bullets), and moves
+	   the circle back to just before it. The rest of the motion is slid along the surface that was hit and swept again,
+	   up to ccdSubsteps times. Each substep only ever moves the circle up to the first surface on its path, so it can't
+	   end up on the far side of anything, and only the fast circles pay for it instead of substepping the whole world.
+	   Velocities are left alone, the contact is there at the start of the next step and the solver deals with it */
+	void sweepFastBodies()
+	{
+		sweptCount = 0;
+		for (int k = 0; k < fastBodies.size(); k++) {
+			int i = fastBodies[k];
+			Vector2 start = sweepStart[k];
+			Vector2 motion = bodies.getPosition(i) - start;
+			bool hit = false;
+			for (int substep = 0; substep < ccdSubsteps && Vector2LengthSqr(motion) > 0; substep++) {
+				Vector2 normal;
+				float toi = timeOfImpact(i, start, motion, &normal);
+				if (toi >= 1.0f)
+				{
+					start = start + motion;
+					break;
+				}
+				hit = true;
+				start = start + motion * toi;
+				motion = motion * (1.0f - toi);
+				motion = motion - normal * min(Vector2DotProduct(motion, normal), 0.0f); // Slide, drop the part going into the surface
+			}
+			if (hit)
+			{
+				bodies.setPosition(i, start);
+				sweptCount++;
+			}
+		}
+	}
+
+	// Before integrate: remember which circles are about to move fast and where they start from
+	// Both integrators move positions by the velocity the body has right now, so this is the motion the step will make.
+	// The substep solver has already moved everything by now, so its circles are swept from where the step started
+	void findFastBodies()
+	{
+		fastBodies.clear();
+		sweepStart.clear();
+		if (!continuousCollision) return;
+		bool moved = usingSubsteps();
+		for (int i = 0; i < bodies.size(); i++) {
+			if (!(bodies.flags[i] & BODY_CIRCLE) || bodies.inverseMass[i] == 0.0f) continue; // Static and sleeping bodies don't move
+			float reach = ccdMotionFraction * bodies.radius[i];
+			Vector2 motion = moved ? bodies.getPosition(i) - bodies.getPreviousPosition(i) : bodies.getVelocity(i) * dt;
+			if (Vector2LengthSqr(motion) <= reach * reach) continue;
+			fastBodies.push_back(i);
+			sweepStart.push_back(moved ? bodies.getPreviousPosition(i) : bodies.getPosition(i));
+		}
+	}
+
+	// Fraction of motion circle i can move from start before it comes within ccdSkin of a halfspace or another circle, 1 if nothing is in the way
+	// normal is the direction to push back in at the first impact
+	float timeOfImpact(int i, Vector2 start, Vector2 motion, Vector2* normal)
+	{
+		float radius = bodies.radius[i];
+		float motionSqr = Vector2LengthSqr(motion);
+		float toi = 1.0f;
+		// The impulse solver picks up contacts that are just apart, the position and substep solvers only push bodies that overlap
+		float stopGap = usingImpulses() ? ccdSkin : -ccdSkin;
+
+		// Halfspaces, distance to the plane goes down linearly with the motion
+		for (int j : unbounded) {
+			if (!(bodies.flags[j] & BODY_HALFSPACE)) continue;
+			Vector2 planeNormal = ((physicsHalfspace*)objects[j])->getNormal();
+			float gap = Vector2DotProduct(start - bodies.getPosition(j), planeNormal) - radius;
+			float approach = -Vector2DotProduct(motion, planeNormal);
+			if (gap < min(stopGap, 0.0f) || approach <= 0) continue; // Already overlapping (the solver pushes it out) or moving away
+			float distance = max(gap - stopGap, 0.0f);
+			if (distance >= approach * toi) continue;
+			toi = distance / approach;
+			*normal = planeNormal;
+		}
+
+		// Circles, solve |start + motion * t - center| = radius + other radius, same as world.rayCast
+		auto sweepCircle = [&](int j) {
+			if (j == i || !(bodies.flags[j] & BODY_CIRCLE)) return true;
+			float sumOfRadii = radius + bodies.radius[j];
+			float reach = sumOfRadii + stopGap;
+			float overlapping = min(sumOfRadii, reach);
+			Vector2 offset = start - bodies.getPosition(j);
+			float distanceSqr = Vector2DotProduct(offset, offset);
+			float b = Vector2DotProduct(offset, motion);
+			if (distanceSqr < overlapping * overlapping || b >= 0) return true; // Already overlapping (the solver pushes them apart) or moving away
+			float c = distanceSqr - reach * reach;
+			float discriminant = b * b - motionSqr * c;
+			if (discriminant < 0) return true; // Passes by
+			float t = (c <= 0) ? 0.0f : (-b - sqrtf(discriminant)) / motionSqr; // Already closer than the stopping distance, stop right here
+			if (t < toi)
+			{
+				toi = t;
+				*normal = Vector2Normalize(offset + motion * t);
+			}
+			return true;
+		};
+		Vector2 end = start + motion;
+		Vector2 extents = { radius + ccdSkin, radius + ccdSkin }; // Other circles are found by their own boxes, the path only needs this circle's
+		AABB path = { Vector2Min(start, end) - extents, Vector2Max(start, end) + extents };
+		bool searched = false;
+		if (broadphase == BROADPHASE_GRID) searched = grid.forEachInRect(path.min, path.max, 64, sweepCircle); // The cells the grid was built with this step
+		else if (broadphase == BROADPHASE_TREE)
+		{
+			tree.query(path, sweepCircle); // Leaves were fattened by each circle's motion this step, so they still cover where it ended
+			searched = true;
+		}
+		if (!searched)
+		{
+			for (int j = 0; j < bodies.size(); j++) {
+				sweepCircle(j);
+			}
+		}
+		return max(toi, 0.0f);
+	}
+
+	// Root of body i's island, halves the path on the way up
+	int findIsland(int i)
+	{
+		while (islandParent[i] != i) {
+			islandParent[i] = islandParent[islandParent[i]];
+			i = islandParent[i];
+		}
+		return i;
+	}
+
+	// Wake every sleeping body
+	void wakeAll()
+	{
+		for (int i = 0; i < bodies.size(); i++) {
+			if (bodies.flags[i] & BODY_ASLEEP) bodies.wake(i);
+		}
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//                       ___                   _        _   
+	//      ___ __ ___ _____/ __|_ _  __ _ _ __ __| |_  ___| |_ 
+	//     (_-</ _` \ V / -_)__ \ ' \/ _` | '_ (_-< ' \/ _ \  _|
+	//     /__/\__,_|\_/\___|___/_||_\__,_| .__/__/_||_\___/\__|
+	//                                    |_|                   
+	// Write everything the next step depends on into blob, loadSnapshot carries on from exactly this point
+	/* A snapshotHeader, then every body array as it sits in memory, the halfspace rotations, the handle table, the contact
+	   cache, the broadphase tree and the sleep watch list. Arrays are stored raw, so loading is a resize and a memcpy each
+	   and the blob is only as big as the data. Native byte order, it's for the machine that wrote it.
+	   Settings (broadphase, solver, the toggles) aren't saved, so one snapshot can be continued under different settings */
+	void saveSnapshot(vector<unsigned char>& blob, simulationClock clock)
+	{
+		snapshotHeader header = {};
+		header.magic = SNAPSHOT_MAGIC;
+		header.version = SNAPSHOT_VERSION;
+		bodies.forEachArray([&](auto& values) { header.bodyBytes += sizeof(values[0]); });
+		header.bodyCount = bodies.size();
+		for (int i = 0; i < bodies.size(); i++) {
+			if (bodies.flags[i] & BODY_HALFSPACE) header.halfspaceCount++;
+		}
+		header.handleCount = (int)handleIndex.size();
+		header.freeHandleCount = (int)freeHandles.size();
+		header.contactCount = (int)contactCache.size();
+		header.treeNodeCount = (int)tree.nodes.size();
+		header.treeRoot = tree.root;
+		header.treeFreeList = tree.freeList;
+		header.watchCount = (int)wakeWatch.size();
+		header.objCount = objCount;
+		header.islandCount = islandCount;
+		header.randomState = randomState;
+		header.gravityAcceleration = gravityAcceleration;
+		header.clock = clock;
+
+		blob.clear();
+		appendBytes(blob, &header, sizeof(header));
+		bodies.forEachArray([&](auto& values) { appendBytes(blob, values.data(), values.size() * sizeof(values[0])); });
+		for (int i = 0; i < bodies.size(); i++) {
+			if (!(bodies.flags[i] & BODY_HALFSPACE)) continue;
+			float rotation = ((physicsHalfspace*)objects[i])->getRotation(); // The normal lives in the view, not the body arrays
+			appendBytes(blob, &rotation, sizeof(rotation));
+		}
+		appendBytes(blob, handleIndex.data(), handleIndex.size() * sizeof(int));
+		appendBytes(blob, handleGeneration.data(), handleGeneration.size() * sizeof(unsigned int));
+		appendBytes(blob, freeHandles.data(), freeHandles.size() * sizeof(unsigned int));
+		appendBytes(blob, contactCache.data(), contactCache.size() * sizeof(cachedContact));
+		appendBytes(blob, tree.nodes.data(), tree.nodes.size() * sizeof(treeNode));
+		appendBytes(blob, wakeWatch.data(), wakeWatch.size() * sizeof(float));
+		header.checksum = ComputeCRC32(blob.data() + sizeof(header), (int)(blob.size() - sizeof(header)));
+		memcpy(blob.data(), &header, sizeof(header));
+	}
+
+	static void appendBytes(vector<unsigned char>& blob, const void* data, size_t size)
+	{
+		blob.insert(blob.end(), (const unsigned char*)data, (const unsigned char*)data + size);
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//      _              _ ___                   _        _   
+	//     | |___  __ _ __| / __|_ _  __ _ _ __ __| |_  ___| |_ 
+	//     | / _ \/ _` / _` \__ \ ' \/ _` | '_ (_-< ' \/ _ \  _|
+	//     |_\___/\__,_\__,_|___/_||_\__,_| .__/__/_||_\___/\__|
+	//                                    |_|                   
+	// Put the world back the way saveSnapshot found it and hand back the clock it was saved with
+	// Returns false and leaves the world alone if blob isn't an intact snapshot of this version or its views can't be made
+	/* Everything is decoded into copies and checked before the world is touched: the checksum catches damaged bytes, and
+	   every index the step will follow (handle slots, the free list, contact handles, tree links, proxies) is range
+	   checked so a blob that slips past the checksum still can't send the world out of bounds.
+	   External bodies belong to the caller, so they are matched by handle to the external views still in the world (the
+	   halfspace keeps its view). Every other body gets a view from newView, and the views the world owned before go to
+	   releaseView. External objects added after the snapshot was taken are no longer in the world afterwards */
+	bool loadSnapshot(const vector<unsigned char>& blob, simulationClock* clock, function<physicObject*(ObjectType)> newView,
+		function<void(physicObject*)> releaseView)
+	{
+		snapshotHeader header;
+		if (blob.size() < sizeof(header)) return false;
+		memcpy(&header, blob.data(), sizeof(header));
+		unsigned int bodyBytes = 0;
+		bodies.forEachArray([&](auto& values) { bodyBytes += sizeof(values[0]); });
+		if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION || header.bodyBytes != bodyBytes) return false;
+		if ((header.bodyCount | header.halfspaceCount | header.handleCount | header.freeHandleCount | header.contactCount
+			| header.treeNodeCount | header.watchCount) < 0) return false;
+		size_t expected = sizeof(header) + (size_t)header.bodyCount * bodyBytes + header.halfspaceCount * sizeof(float)
+			+ header.handleCount * (sizeof(int) + sizeof(unsigned int)) + header.freeHandleCount * sizeof(unsigned int)
+			+ header.contactCount * sizeof(cachedContact) + header.treeNodeCount * sizeof(treeNode) + header.watchCount * sizeof(float);
+		if (blob.size() != expected) return false;
+		if (ComputeCRC32((unsigned char*)blob.data() + sizeof(header), (int)(blob.size() - sizeof(header))) != header.checksum) return false;
+
+		const unsigned char* data = blob.data() + sizeof(header);
+		physicsBodies loaded;
+		loaded.forEachArray([&](auto& values) {
+			values.resize(header.bodyCount);
+			data = readBytes(data, values);
+		});
+		vector<float> rotations(header.halfspaceCount);
+		vector<int> loadedIndex(header.handleCount);
+		vector<unsigned int> loadedGeneration(header.handleCount);
+		vector<unsigned int> loadedFree(header.freeHandleCount);
+		vector<cachedContact> loadedContacts(header.contactCount);
+		vector<treeNode> loadedNodes(header.treeNodeCount);
+		vector<float> loadedWatch(header.watchCount);
+		data = readBytes(data, rotations);
+		data = readBytes(data, loadedIndex);
+		data = readBytes(data, loadedGeneration);
+		data = readBytes(data, loadedFree);
+		data = readBytes(data, loadedContacts);
+		data = readBytes(data, loadedNodes);
+		data = readBytes(data, loadedWatch);
+		if (!snapshotConsistent(header, loaded, loadedIndex, loadedFree, loadedContacts, loadedNodes)) return false;
+
+		// Views for every body before anything changes, so a failure leaves the world as it was
+		vector<physicObject*> views(header.bodyCount, nullptr);
+		bool viewsReady = true;
+		for (int i = 0; i < header.bodyCount && viewsReady; i++) {
+			unsigned char flags = loaded.flags[i];
+			if (flags & BODY_EXTERNAL)
+			{
+				unsigned int slot = loaded.handle[i];
+				int current = (slot < handleIndex.size()) ? handleIndex[slot] : -1;
+				if (current == -1 || !(bodies.flags[current] & BODY_EXTERNAL)) viewsReady = false;
+				else views[i] = objects[current];
+			}
+			else
+			{
+				views[i] = newView((flags & BODY_CIRCLE) ? CIRCLE : HALFSPACE);
+				if (views[i] == nullptr) viewsReady = false;
+			}
+		}
+		if (!viewsReady)
+		{
+			for (int i = 0; i < header.bodyCount; i++) {
+				if (views[i] != nullptr && !(loaded.flags[i] & BODY_EXTERNAL)) releaseView(views[i]);
+			}
+			return false;
+		}
+
+		for (physicObject* view : objects) {
+			if (!view->isExternal()) releaseView(view);
+		}
+		swap(bodies, loaded);
+		handleIndex.swap(loadedIndex);
+		handleGeneration.swap(loadedGeneration);
+		freeHandles.swap(loadedFree);
+		contactCache.swap(loadedContacts);
+		tree.nodes.swap(loadedNodes);
+		wakeWatch.swap(loadedWatch);
+		tree.root = header.treeRoot;
+		tree.freeList = header.treeFreeList;
+		objCount = header.objCount;
+		islandCount = header.islandCount;
+		randomState = header.randomState;
+		gravityAcceleration = header.gravityAcceleration;
+		*clock = header.clock;
+
+		objects = views;
+		int halfspaces = 0;
+		for (int i = 0; i < bodies.size(); i++) {
+			objects[i]->bodies = &bodies;
+			objects[i]->index = i;
+			objects[i]->handle = { bodies.handle[i], handleGeneration[bodies.handle[i]] };
+			if (bodies.flags[i] & BODY_HALFSPACE) ((physicsHalfspace*)objects[i])->setRotation(rotations[halfspaces++]);
+		}
+		return true;
+	}
+
+	// True if every index in a decoded snapshot points somewhere that exists, and the handle table and bodies agree
+	static bool snapshotConsistent(const snapshotHeader& header, physicsBodies& loaded, const vector<int>& handleIndex,
+		const vector<unsigned int>& freeHandles, const vector<cachedContact>& contacts, const vector<treeNode>& nodes)
+	{
+		int bodyCount = header.bodyCount;
+		int handleCount = header.handleCount;
+		int nodeCount = header.treeNodeCount;
+		auto validNode = [&](int node) { return node >= -1 && node < nodeCount; }; // -1 is "none"
+
+		int halfspaces = 0;
+		for (int i = 0; i < bodyCount; i++) {
+			if (loaded.flags[i] & BODY_HALFSPACE) halfspaces++;
+			unsigned int slot = loaded.handle[i];
+			if (slot >= handleCount || handleIndex[slot] != i) return false;
+			int proxy = loaded.proxyId[i];
+			if (!validNode(proxy) || (proxy != -1 && nodes[proxy].object != i)) return false;
+		}
+		if (halfspaces != header.halfspaceCount) return false;
+		for (int slot = 0; slot < handleCount; slot++) {
+			if (handleIndex[slot] < -1 || handleIndex[slot] >= bodyCount) return false;
+		}
+		for (unsigned int slot : freeHandles) {
+			if (slot >= handleCount || handleIndex[slot] != -1) return false;
+		}
+		for (const cachedContact& contact : contacts) {
+			if (contact.a.slot >= handleCount || contact.b.slot >= handleCount) return false;
+		}
+		if (!validNode(header.treeRoot) || !validNode(header.treeFreeList)) return false;
+		for (const treeNode& node : nodes) {
+			if (!validNode(node.parent) || !validNode(node.left) || !validNode(node.right)) return false;
+			if ((node.left == -1) != (node.right == -1)) return false; // Branches have both children, leaves neither
+			if (node.object < -1 || node.object >= bodyCount) return false;
+		}
+		return true;
+	}
+
+	// Fill values from data, returns where the next array starts
+	template<typename T>
+	static const unsigned char* readBytes(const unsigned char* data, vector<T>& values)
+	{
+		if (!values.empty()) memcpy(values.data(), data, values.size() * sizeof(T)); // An empty vector's data() can be null
+		return data + values.size() * sizeof(T);
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//      _         _ _    _ ___ _             ___               _    
+	//     | |__ _  _(_) |__| / __| |_ ___ _ __ / __|_ _ __ _ _ __| |_  
+	//     | '_ \ || | | / _` \__ \  _/ -_) '_ \ (_ | '_/ _` | '_ \ ' \ 
+	//     |_.__/\_,_|_|_\__,_|___/\__\___| .__/\___|_| \__,_| .__/_||_|
+	//                                    |_|                |_|        
+	// Describe one step as jobs, the arrows are the order of operations that matters
+	/* clearContacts -> buildBroadphase -> gatherPairs -> mergePairs -> filterPairs -> colorPairs -------> resolveContacts -> updateColors ----------.
+	                                                                                 `-> refreshContacts -'       |          `-> recordForceVectors -> integrate -> updateSleep
+	   storePreviousPositions ------------------------------------------------------------------------------------'
+	   With the impulse solver, buildBroadphase -> integrateVelocities -> resolveContacts, and integrate only moves the positions.
+	   The substep solver moves everything inside resolveContacts, so integrate has nothing left to do.
+	   findFastBodies runs just before integrate and sweepFastBodies between integrate and updateSleep
+	   Per object and per pair stages are parallel fors, the rest run once. clearContacts comes first since the broadphase
+	   reads the shape bits from the same flags bytes.
+	   The graph reads the settings (broadphase, narrowphase mode, ...) every time it runs */
+	void buildStepGraph()
+	{
+		auto bodyCount = [this]() { return bodies.size(); };
+
+		int store = stepGraph.addParallelFor("store previous", bodyCount, BODY_GRAIN, [this](int begin, int end) { storePreviousPositions(begin, end); });
+		int clear = stepGraph.addParallelFor("clear contacts", bodyCount, BODY_GRAIN, [this](int begin, int end) { clearContacts(begin, end); });
+		int build = stepGraph.add("broadphase", [this]() { buildBroadphase(); });
+		int gather = stepGraph.addParallelFor("gather pairs", bodyCount, BODY_GRAIN, [this](int begin, int end) { gatherPairs(begin, end); });
+		int merge = stepGraph.add("merge pairs", [this]() { mergePairs(); });
+		int filter = stepGraph.addParallelFor("filter pairs", [this]() { return (int)pairs.size(); }, PAIR_GRAIN, [this](int begin, int end) { filterPairs(begin, end); });
+		int color = stepGraph.add("color pairs", [this]() { colorPairs(); });
+		int cache = stepGraph.add("contact cache", [this]() { refreshContacts(); });
+		int resolve = stepGraph.add("resolve contacts", [this]() { resolveContacts(); });
+		int colors = stepGraph.addParallelFor("update colors", bodyCount, BODY_GRAIN, [this](int begin, int end) { updateColors(begin, end); });
+		int forces = stepGraph.addParallelFor("force vectors", [this]() { return debugDraw.wants(DEBUG_GRAVITY | DEBUG_NET_FORCE) ? bodies.size() : 0; },
+			BODY_GRAIN, [this](int begin, int end) { recordForceVectors(begin, end); }); // Before integrate() clears the forces
+		int accelerate = stepGraph.addParallelFor("integrate velocities", [this]() { return usingImpulses() ? bodies.size() : 0; },
+			BODY_GRAIN, [this](int begin, int end) { integrateVelocities(begin, end); });
+		int move = stepGraph.addParallelFor("integrate", [this]() { return usingSubsteps() ? 0 : bodies.size(); }, BODY_GRAIN, [this](int begin, int end) {
+			if (usingImpulses()) integratePositions(begin, end);
+			else integrate(begin, end);
+		});
+		int fast = stepGraph.add("find fast bodies", [this]() { findFastBodies(); });
+		int sweep = stepGraph.add("sweep fast bodies", [this]() { sweepFastBodies(); });
+		int sleep = stepGraph.add("sleep", [this]() { updateSleep(); });
+
+		stepGraph.dependsOn(build, clear);
+		stepGraph.dependsOn(gather, build);
+		stepGraph.dependsOn(merge, gather);
+		stepGraph.dependsOn(filter, merge);
+		stepGraph.dependsOn(color, filter);
+		stepGraph.dependsOn(resolve, color);
+		stepGraph.dependsOn(cache, filter);
+		stepGraph.dependsOn(resolve, cache);
+		stepGraph.dependsOn(accelerate, build); // The tree reads the velocities to fatten its boxes
+		stepGraph.dependsOn(resolve, accelerate);
+		stepGraph.dependsOn(resolve, store);
+		stepGraph.dependsOn(colors, resolve);
+		stepGraph.dependsOn(forces, resolve);
+		stepGraph.dependsOn(move, forces);
+		stepGraph.dependsOn(fast, forces);
+		stepGraph.dependsOn(move, fast);
+		stepGraph.dependsOn(sweep, move);
+		stepGraph.dependsOn(sleep, sweep);
+		stepGraph.dependsOn(sleep, colors); // Both touch the flags
+	}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//                    _      _        ___  _     _        _   
+	//      _  _ _ __  __| |__ _| |_ ___ / _ \| |__ (_)___ __| |_ 
+	//     | || | '_ \/ _` / _` |  _/ -_) (_) | '_ \| / -_) _|  _|
+	//      \_,_| .__/\__,_\__,_|\__\___|\___/|_.__// \___\__|\__|
+	//          |_|                               |__/ 
+	// Updatephysics world for one time step, order of operations matters (see buildStepGraph)
+	void updateObject() {
+		if (stepGraph.empty()) buildStepGraph();
+		debugDraw.clear(jobs.workerCount() + 1);
+		stepGraph.run(jobs); // Collision detection and response, then gravity, drag and collected forces move the objects
+	}
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+//          _     _        _   ___          _ 
+//      ___| |__ (_)___ __| |_| _ \___  ___| |
+//     / _ \ '_ \| / -_) _|  _|  _/ _ \/ _ \ |
+//     \___/_.__// \___\__|\__|_| \___/\___/_|
+//             |__/                           
+// Slab allocator for objects that get created and destroyed all the time (spawned circles)
+/* Memory comes in slabs of SLAB_SIZE objects that are never freed or moved while the pool is alive, so pointers stay valid
+   and objects sit next to each other instead of all over the heap. A released slot goes on the free list and is the next
+   one handed out. The pool only frees memory when it is destroyed, and doesn't run the destructors of objects still in use */
+template <typename T, int SLAB_SIZE = 256>
+class objectPool
+{
+public:
+	// Construct a T in a free slot, a new slab is added if every slot is in use
+	T* acquire()
+	{
+		if (freeSlots.empty()) addSlab();
+		T* slot = freeSlots.back();
+		freeSlots.pop_back();
+		live++;
+		if (live > highWater) highWater = live;
+		return new (slot) T();
+	}
+
+	// Destroy object and give its slot back, object must have come from this pool
+	void release(T* object)
+	{
+		object->~T();
+		freeSlots.push_back(object);
+		live--;
+	}
+
+	// True if object points into one of this pool's slabs
+	bool owns(const void* object)
+	{
+		const unsigned char* address = (const unsigned char*)object;
+		for (unique_ptr<slab>& block : slabs) {
+			if (address >= block->storage && address < block->storage + sizeof(block->storage)) return true;
+		}
+		return false;
+	}
+
+	// Usage statistics, for sizing SLAB_SIZE to a scene
+	int liveCount() { return live; }
+	int freeCount() { return (int)freeSlots.size(); }
+	int highWaterMark() { return highWater; } // Most objects alive at once
+	int capacity() { return (int)slabs.size() * SLAB_SIZE; }
+
+private:
+	struct slab
+	{
+		alignas(T) unsigned char storage[sizeof(T) * SLAB_SIZE];
+	};
+
+	vector<unique_ptr<slab>> slabs;
+	vector<T*> freeSlots; // Last one is handed out next
+	int live = 0;
+	int highWater = 0;
+
+	void addSlab()
+	{
+		slabs.push_back(make_unique<slab>());
+		T* first = (T*)slabs.back()->storage;
+		for (int i = SLAB_SIZE - 1; i >= 0; i--) {
+			freeSlots.push_back(first + i); // Backwards, so the slab gets used front to back
+		}
+	}
+};
+
+// Define global physics world
+physicsWorld world;
+
+// Circles spawned at runtime come from here instead of new / delete
+objectPool<physicsCircle> circlePool;
+
+// Define global halfspace
+physicsHalfspace halfspace;
+physicsHalfspace halfspace_2;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//    _________        .__  .__  .__                   __________                                                    ___________                   __  .__                      
+//    \_   ___ \  ____ |  | |  | |__| __________   ____\______   \ ____   ____________   ____   ____   ______ ____   \_   _____/_ __  ____   _____/  |_|__| ____   ____   ______
+//    /    \  \/ /  _ \|  | |  | |  |/  ___/  _ \ /    \|       _// __ \ /  ___/\____ \ /  _ \ /    \ /  ___// __ \   |    __)|  |  \/    \_/ ___\   __\  |/  _ \ /    \ /  ___/
+//    \     \___(  <_> )  |_|  |_|  |\___ (  <_> )   |  \    |   \  ___/ \___ \ |  |_> >  <_> )   |  \\___ \\  ___/   |     \ |  |  /   |  \  \___|  | |  (  <_> )   |  \\___ \ 
+//     \______  /\____/|____/____/__/____  >____/|___|  /____|_  /\___  >____  >|   __/ \____/|___|  /____  >\___  >  \___  / |____/|___|  /\___  >__| |__|\____/|___|  /____  >
+//            \/                         \/           \/       \/     \/     \/ |__|               \/     \/     \/       \/             \/     \/                    \/     \/     
+
+
+
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//       ___ _        _      ___ _        _      ___     _ _ _    _          ___                               
+	//      / __(_)_ _ __| |___ / __(_)_ _ __| |___ / __|___| | (_)__(_)___ _ _ | _ \___ ____ __  ___ _ _  ___ ___ 
+	//     | (__| | '_/ _| / -_) (__| | '_/ _| / -_) (__/ _ \ | | (_-< / _ \ ' \|   / -_|_-< '_ \/ _ \ ' \(_-</ -_)
+	//      \___|_|_| \__|_\___|\___|_|_| \__|_\___|\___\___/_|_|_/__/_\___/_||_|_|_\___/__/ .__/\___/_||_/__/\___|
+	//                                                                                     |_| 
+	//                                         Circle-Circle Collision Response                   
+bool CircleCircleCollisionResponse(physicsBodies& bodies, int circleA, int circleB)
+{
+	Vector2 displacementFromAtoB = Vector2Subtract(bodies.getPosition(circleB), bodies.getPosition(circleA)); // Same thing as circleB.position - circleA.position
+	float distance = Vector2Length(displacementFromAtoB); // Use pythagorean thoreom to get magnitude of displacement vector betwen circles
+	float sumOfRadii = bodies.radius[circleA] + bodies.radius[circleB];
+	float overlap = sumOfRadii - distance; // Sum of radii = 5, distance = 10, overlap = -5 (no overlap)
+
+
+	if (overlap > 0) // if overlap is positive, we have collision
+	{
+		Vector2 normal = displacementFromAtoB / distance; // Normalize displacement vector to get collision normal
+		if (distance == 0) normal = { 0, -1 }; // Exactly on top of each other, there is no direction to push in so pick one
+		Vector2 mtv = normal * overlap; // minimum translation vector (to move objects out of collision)
+		// Split by inverse mass like the impulse solvers, so a sleeping or static circle (inverse mass 0) doesn't get pushed
+		float inverseMassSum = bodies.inverseMass[circleA] + bodies.inverseMass[circleB];
+		if (inverseMassSum == 0.0f) return true; // Neither can move
+		bodies.setPosition(circleA, bodies.getPosition(circleA) - mtv * (bodies.inverseMass[circleA] / inverseMassSum));
+		bodies.setPosition(circleB, bodies.getPosition(circleB) + mtv * (bodies.inverseMass[circleB] / inverseMassSum));
+		return true; // Overlapping
+	}
+	else
+		return false; // Not overlapping
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+//       ___ _        _      ___ _        _      ___              _           __  __         _   
+//      / __(_)_ _ __| |___ / __(_)_ _ __| |___ / _ \__ _____ _ _| |__ _ _ __|  \/  |__ _ __| |__
+//     | (__| | '_/ _| / -_) (__| | '_/ _| / -_) (_) \ V / -_) '_| / _` | '_ \ |\/| / _` (_-< / /
+//      \___|_|_| \__|_\___|\___|_|_| \__|_\___|\___/ \_/\___|_| |_\__,_| .__/_|  |_\__,_/__/_\_\
+//                                                                      |_|                      
+//                                     Circle-Circle Overlap Mask (SIMD narrowphase)
+// Squared distance rejection for NARROWPHASE_LANES circle pairs at once. Bit k of the result is set if pairs[k] might overlap.
+// It is conservative: any pair CircleCircleCollisionResponse would accept always gets its bit set, the scalar response
+// makes the final call, so the SIMD path gives exactly the same results while skipping the square root for far pairs
+unsigned int CircleCircleOverlapMask(physicsBodies& bodies, const collisionPair* pairs)
+{
+	// Slightly inflate the limit to cover rounding differences between d^2 < r^2 and sqrt(d^2) < r
+	const float rejectMargin = 1.0f + 1e-5f;
+#if NARROWPHASE_LANES == 8
+	// Pairs are stored a0 b0 a1 b1 ..., shuffle them into one register of a's and one of b's
+	__m256i pairsLow = _mm256_loadu_si256((const __m256i*)pairs);
+	__m256i pairsHigh = _mm256_loadu_si256((const __m256i*)(pairs + 4));
+	__m256i split = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+	pairsLow = _mm256_permutevar8x32_epi32(pairsLow, split); // a0 a1 a2 a3 b0 b1 b2 b3
+	pairsHigh = _mm256_permutevar8x32_epi32(pairsHigh, split); // a4 a5 a6 a7 b4 b5 b6 b7
+	__m256i indexA = _mm256_permute2x128_si256(pairsLow, pairsHigh, 0x20);
+	__m256i indexB = _mm256_permute2x128_si256(pairsLow, pairsHigh, 0x31);
+
+	__m256 dx = _mm256_sub_ps(_mm256_i32gather_ps(bodies.positionX.data(), indexB, 4), _mm256_i32gather_ps(bodies.positionX.data(), indexA, 4));
+	__m256 dy = _mm256_sub_ps(_mm256_i32gather_ps(bodies.positionY.data(), indexB, 4), _mm256_i32gather_ps(bodies.positionY.data(), indexA, 4));
+	__m256 sumOfRadii = _mm256_add_ps(_mm256_i32gather_ps(bodies.radius.data(), indexA, 4), _mm256_i32gather_ps(bodies.radius.data(), indexB, 4));
+	__m256 distanceSqr = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+	__m256 limit = _mm256_mul_ps(_mm256_mul_ps(sumOfRadii, sumOfRadii), _mm256_set1_ps(rejectMargin));
+	return (unsigned int)_mm256_movemask_ps(_mm256_cmp_ps(distanceSqr, limit, _CMP_LE_OQ)); // NaN positions compare false, same as the scalar test
+#elif NARROWPHASE_LANES == 4
+	// SSE2 has no gather, load the four lanes by hand
+	const float* x = bodies.positionX.data();
+	const float* y = bodies.positionY.data();
+	const float* r = bodies.radius.data();
+	__m128 dx = _mm_sub_ps(_mm_setr_ps(x[pairs[0].b], x[pairs[1].b], x[pairs[2].b], x[pairs[3].b]), _mm_setr_ps(x[pairs[0].a], x[pairs[1].a], x[pairs[2].a], x[pairs[3].a]));
+	__m128 dy = _mm_sub_ps(_mm_setr_ps(y[pairs[0].b], y[pairs[1].b], y[pairs[2].b], y[pairs[3].b]), _mm_setr_ps(y[pairs[0].a], y[pairs[1].a], y[pairs[2].a], y[pairs[3].a]));
+	__m128 sumOfRadii = _mm_add_ps(_mm_setr_ps(r[pairs[0].a], r[pairs[1].a], r[pairs[2].a], r[pairs[3].a]), _mm_setr_ps(r[pairs[0].b], r[pairs[1].b], r[pairs[2].b], r[pairs[3].b]));
+	__m128 distanceSqr = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+	__m128 limit = _mm_mul_ps(_mm_mul_ps(sumOfRadii, sumOfRadii), _mm_set1_ps(rejectMargin));
+	return (unsigned int)_mm_movemask_ps(_mm_cmple_ps(distanceSqr, limit));
+#else
+	float dx = bodies.positionX[pairs[0].b] - bodies.positionX[pairs[0].a];
+	float dy = bodies.positionY[pairs[0].b] - bodies.positionY[pairs[0].a];
+	float sumOfRadii = bodies.radius[pairs[0].a] + bodies.radius[pairs[0].b];
+	return (dx * dx + dy * dy <= sumOfRadii * sumOfRadii * rejectMargin) ? 1u : 0u;
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+//       ___ _        _     _  _      _  __                       ___     _ _ _    _          ___                               
+//      / __(_)_ _ __| |___| || |__ _| |/ _|____ __  __ _ __ ___ / __|___| | (_)__(_)___ _ _ | _ \___ ____ __  ___ _ _  ___ ___ 
+//     | (__| | '_/ _| / -_) __ / _` | |  _(_-< '_ \/ _` / _/ -_) (__/ _ \ | | (_-< / _ \ ' \|   / -_|_-< '_ \/ _ \ ' \(_-</ -_)
+//      \___|_|_| \__|_\___|_||_\__,_|_|_| /__/ .__/\__,_\__\___|\___\___/_|_|_/__/_\___/_||_|_|_\___/__/ .__/\___/_||_/__/\___|
+//                                            |_|                                                       |_|                     
+//										Circle-Halfspace Collision Response
+bool CircleHalfspaceCollisionResponse(physicsBodies& bodies, int circle, physicsHalfspace* halfspace, cachedContact* contact)
+{
+	Vector2 circlePosition = bodies.getPosition(circle);
+	Vector2 displacementFromHalfspaceToCircle = Vector2Subtract(circlePosition, halfspace->getPosition()); // Same thing as circleB.position - circleA.position
+	float dot = Vector2DotProduct(displacementFromHalfspaceToCircle, halfspace->getNormal());
+	Vector2 projectionDisplacementOntoNormal = halfspace->getNormal() * dot; // If normal is already normalized, we dont need to do the whole equation for vector projection
+
+	//DRAW LINE FROM CIRCLE TO HALFSPACE
+	//DrawLineEx(circlePosition, circlePosition - projectionDisplacementOntoNormal, 1, GRAY);
+	Vector2 midpoint = circlePosition - projectionDisplacementOntoNormal * 0.5f;
+	//DRAW DISTANCE TEXT
+	//DrawText(TextFormat("Dist: %6.0f", dot), midpoint.x, midpoint.y, 30, GRAY); 
+
+	float overlap = bodies.radius[circle] - dot;// Sum of radii = 5, distance = 10, overlap = -5 (no overlap)
+	if (overlap > 0) // if overlap is positive, we have collision
+	{
+		Vector2 mtv = halfspace->getNormal() * overlap; // minimum translation vector (to move objects out of collision)
+		circlePosition += mtv;
+		bodies.setPosition(circle, circlePosition);
+
+		//Get Gravity Force
+		Vector2 Fgravity = world.gravityAcceleration * bodies.mass[circle];
+
+		//Apply Normal Force
+		Vector2 FgPerp = halfspace->getNormal() * Vector2DotProduct(Fgravity, halfspace->getNormal());
+		Vector2 Fnormal = FgPerp * -1;
+		bodies.addForce(circle, Fnormal);
+
+		if (debugDraw.wants(DEBUG_NORMAL)) debugDraw.addVector(circlePosition, Fnormal, 1, GREEN);
+
+		//Friction
+		//F = uN where is coefficient of friction between two surfaces;
+		//F is the max magnitude of force of friction
+		//N is magnitude of normal force.
+		float u = bodies.grip[circle] * bodies.grip[halfspace->index];
+		float frictionMagnitude = Vector2Length(Fnormal) * u;
+
+		//the direction of friction = opposite other applied forces in the surface plane
+		Vector2 FgPara = Fgravity - FgPerp;
+		Vector2 FrictionDirection = Vector2Normalize(FgPara) * -1;
+		//Vector2 Ffriciton = FrictionDirection * frictionMagnitude;
+		// We have to clamp friction to not exceed the force trying to move the object
+		float maxFriction = Vector2Length(FgPara);
+		if (frictionMagnitude > maxFriction) frictionMagnitude = maxFriction;
+		Vector2 Ffriciton = FrictionDirection * frictionMagnitude;
+
+		bodies.addForce(circle, Ffriciton);
+		if (debugDraw.wants(DEBUG_FRICTION)) debugDraw.addVector(circlePosition, Ffriciton, 2, ORANGE);
+
+		// Impulses the forces add up to over this step, kept in the contact cache for the next one
+		if (contact)
+		{
+			Vector2 tangent = { -halfspace->getNormal().y, halfspace->getNormal().x };
+			contact->normalImpulse = Vector2Length(Fnormal) * dt;
+			contact->tangentImpulse = Vector2DotProduct(Ffriciton, tangent) * dt;
+		}
+		return true; // Overlapping
+	}
+	else
+		return false; // Not overlapping
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//    ________ __________    _____  __      __       /\   ____ _____________________      ___________________________      /\  _________ .____     ___________   _____    _______   ____ _____________ 
+//    \______ \\______   \  /  _  \/  \    /  \     / /  |    |   \______   \______ \    /  _  \__    ___/\_   _____/     / /  \_   ___ \|    |    \_   _____/  /  _  \   \      \ |    |   \______   \
+//     |    |  \|       _/ /  /_\  \   \/\/   /    / /   |    |   /|     ___/|    |  \  /  /_\  \|    |    |    __)_     / /   /    \  \/|    |     |    __)_  /  /_\  \  /   |   \|    |   /|     ___/
+//     |    `   \    |   \/    |    \        /    / /    |    |  / |    |    |    `   \/    |    \    |    |        \   / /    \     \___|    |___  |        \/    |    \/    |    \    |  / |    |    
+//    /_______  /____|_  /\____|__  /\__/\  /    / /     |______/  |____|   /_______  /\____|__  /____|   /_______  /  / /      \______  /_______ \/_______  /\____|__  /\____|__  /______/  |____|    
+//            \/       \/         \/      \/     \/                                 \/         \/                 \/   \/              \/        \/        \/         \/         \/                    
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+//       ___       _    ___   __ ___                   _    __  __         _   
+//      / _ \ _  _| |_ / _ \ / _| _ ) ___ _  _ _ _  __| |__|  \/  |__ _ __| |__
+//     | (_) | || |  _| (_) |  _| _ \/ _ \ || | ' \/ _` (_-< |\/| / _` (_-< / /
+//      \___/ \_,_|\__|\___/|_| |___/\___/\_,_|_||_\__,_/__/_|  |_\__,_/__/_\_\
+//                                                                             
+// Set remove[i] for every body outside the 0..width by 0..height box, returns how many there are
+// Same comparisons as the old one body at a time test (NaN positions compare false and stay), several bodies per instruction
+int OutOfBoundsMask(physicsBodies& bodies, float width, float height, unsigned char* remove)
+{
+	int count = bodies.size();
+	const float* x = bodies.positionX.data();
+	const float* y = bodies.positionY.data();
+	int removed = 0;
+	int i = 0;
+#if defined(PHYSICS_SIMD_AVX2)
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 right = _mm256_set1_ps(width);
+	const __m256 bottom = _mm256_set1_ps(height);
+	for (; i + 8 <= count; i += 8) {
+		__m256 positionX = _mm256_loadu_ps(x + i);
+		__m256 positionY = _mm256_loadu_ps(y + i);
+		__m256 outside = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(positionY, bottom, _CMP_GT_OQ), _mm256_cmp_ps(positionY, zero, _CMP_LT_OQ)),
+			_mm256_or_ps(_mm256_cmp_ps(positionX, right, _CMP_GT_OQ), _mm256_cmp_ps(positionX, zero, _CMP_LT_OQ)));
+		unsigned int mask = (unsigned int)_mm256_movemask_ps(outside);
+		for (int lane = 0; lane < 8; lane++) {
+			remove[i + lane] = (mask >> lane) & 1;
+		}
+	}
+#elif defined(PHYSICS_SIMD_SSE2)
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 right = _mm_set1_ps(width);
+	const __m128 bottom = _mm_set1_ps(height);
+	for (; i + 4 <= count; i += 4) {
+		__m128 positionX = _mm_loadu_ps(x + i);
+		__m128 positionY = _mm_loadu_ps(y + i);
+		__m128 outside = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(positionY, bottom), _mm_cmplt_ps(positionY, zero)),
+			_mm_or_ps(_mm_cmpgt_ps(positionX, right), _mm_cmplt_ps(positionX, zero)));
+		unsigned int mask = (unsigned int)_mm_movemask_ps(outside);
+		for (int lane = 0; lane < 4; lane++) {
+			remove[i + lane] = (mask >> lane) & 1;
+		}
+	}
+#endif
+	for (; i < count; i++) {
+		remove[i] = (y[i] > height || y[i] < 0 || x[i] > width || x[i] < 0) ? 1 : 0;
+	}
+	for (int k = 0; k < count; k++) {
+		removed += remove[k];
+	}
+	return removed;
+}
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	//         _                      __      __       _    _ 
+	//      __| |___ __ _ _ _ _  _ _ _\ \    / /__ _ _| |__| |
+	//     / _| / -_) _` | ' \ || | '_ \ \/\/ / _ \ '_| / _` |
+	//     \__|_\___\__,_|_||_\_,_| .__/\_/\_/\___/_| |_\__,_|
+	//                            |_|                         
+	// Cleanup world by removing objects that are out of bounds
+void cleanupWorld() {
+	physicsBodies& bodies = world.bodies;
+	static vector<unsigned char> remove; // Kept between calls so the mask isn't reallocated every step
+	remove.resize(bodies.size());
+	if (OutOfBoundsMask(bodies, (float)GetScreenWidth(), (float)GetScreenHeight(), remove.data()) == 0) return;
+
+	static vector<physicObject*> removed;
+	removed.clear();
+	for (int i = 0; i < bodies.size(); i++) {
+		if (bodies.flags[i] & BODY_EXTERNAL) remove[i] = 0; // Global objects (halfspaces) belong to the caller, they stay in the world
+		if (remove[i]) removed.push_back(world.objects[i]);
+	}
+	if (removed.empty()) return;
+	world.removeObjects(remove.data()); // One compaction pass instead of an erase per object
+	for (physicObject* pointerTopMain : removed) {
+		circlePool.release((physicsCircle*)pointerTopMain); // Every object the world owns came from the pool, its slot goes back
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+//      _            _    ___ _            
+//     | |_  __ _ __| |_ / __| |_ ___ _ __ 
+//     | ' \/ _` (_-< ' \\__ \  _/ -_) '_ \
+//     |_||_\__,_/__/_||_|___/\__\___| .__/
+//                                   |_|   
+// Hash the bodies after a step, then log it, write it to hashFile and check it against compareFile
+/* Every code path through updateObject (any worker count, SIMD or scalar narrowphase) is meant to give bit for bit
+   the same bodies, so two runs of the same input should hash the same on every step. Run one with --hashes, the other
+   with --compare-hashes on that file and the first step that differs gets logged with its frame number, which is
+   where to start looking. Steps are matched by stepCount, so both runs need the same input, a replay (--replay)
+   or the scene the program starts with. Hashing copies every body array, so it's off unless something asks for it */
+FILE* hashOutput = nullptr;
+vector<unsigned int> expectedHashes; // From compareFile, one per step
+bool divergenceFound = false; // Only the first difference is reported, everything after it differs anyway
+vector<unsigned char> hashScratch;
+
+void hashStep()
+{
+	if (!logHashes && hashOutput == nullptr && expectedHashes.empty())
+	{
+		stepHash = 0;
+		return;
+	}
+	stepHash = world.bodies.hash(hashScratch);
+	if (logHashes) TraceLog(LOG_INFO, "HASH: Frame %i | Step %i | %08X", sessionFrame, stepCount, stepHash);
+	if (hashOutput != nullptr) fprintf(hashOutput, "%i %i %08X\n", sessionFrame, stepCount, stepHash);
+	if (!divergenceFound && stepCount < expectedHashes.size() && stepHash != expectedHashes[stepCount])
+	{
+		divergenceFound = true;
+		TraceLog(LOG_WARNING, "HASH: First divergence at frame %i, step %i: %08X, expected %08X", sessionFrame, stepCount, stepHash, expectedHashes[stepCount]);
+	}
+}
+
+// Open hashFile and read compareFile, if they were asked for
+void openHashFiles()
+{
+	if (hashFile != nullptr && (hashOutput = fopen(hashFile, "w")) == nullptr) TraceLog(LOG_WARNING, "HASH: Couldn't write %s", hashFile);
+	if (compareFile == nullptr) return;
+	char* text = LoadFileText(compareFile);
+	if (text == nullptr) return;
+	int frame, step, offset;
+	unsigned int hash;
+	for (const char* line = text; sscanf(line, "%i %i %X%n", &frame, &step, &hash, &offset) == 3; line += offset) {
+		if (step >= expectedHashes.size()) expectedHashes.resize(step + 1);
+		expectedHashes[step] = hash;
+	}
+	UnloadFileText(text);
+	TraceLog(LOG_INFO, "HASH: Comparing against %i steps from %s", (int)expectedHashes.size(), compareFile);
+}
+
+void closeHashFiles()
+{
+	if (hashOutput != nullptr) fclose(hashOutput);
+	hashOutput = nullptr;
+	if (!expectedHashes.empty() && !divergenceFound)
+	{
+		TraceLog(LOG_INFO, "HASH: %i of %i steps compared, all matched", min(stepCount, (int)expectedHashes.size()), (int)expectedHashes.size());
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+//         _          __      __       _    _ 
+//      __| |_ ___ _ _\ \    / /__ _ _| |__| |
+//     (_-<  _/ -_) '_ \ \/\/ / _ \ '_| / _` |
+//     /__/\__\___| .__/\_/\_/\___/_| |_\__,_|
+//                |_|                         
+// Advance the simulation by one fixed step of dt seconds, can be called any number of times per rendered frame
+void stepWorld()
+{
+	double stepStart = GetTime();
+	cleanupWorld();
+	world.updateObject();
+	simTime += dt;
+	hashStep();
+	stepCount++;
+	stepMilliseconds = (float)((GetTime() - stepStart) * 1000.0);
+}
+
+// Save or restore the whole simulation with the fixed timestep globals, see physicsWorld::saveSnapshot
+void saveWorld(vector<unsigned char>& blob)
+{
+	world.saveSnapshot(blob, { simTime, accumulator, physicsRate });
+}
+
+// Spawned circles in the snapshot get fresh views from circlePool, the current ones go back to it
+bool restoreWorld(const vector<unsigned char>& blob)
+{
+	simulationClock clock;
+	bool restored = world.loadSnapshot(blob, &clock,
+		[](ObjectType shape) -> physicObject* { return (shape == CIRCLE) ? circlePool.acquire() : nullptr; }, // The world only owns circles
+		[](physicObject* view) { circlePool.release((physicsCircle*)view); });
+	if (!restored) return false;
+	simTime = clock.simTime;
+	accumulator = clock.accumulator;
+	physicsRate = clock.physicsRate;
+	dt = 1.0f / physicsRate;
+	alpha = accumulator / dt;
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+//         _           _             _     _ __      __       _    _ 
+//      __| |_  ___ __| |___ __  ___(_)_ _| |\ \    / /__ _ _| |__| |
+//     / _| ' \/ -_) _| / / '_ \/ _ \ | ' \  _\ \/\/ / _ \ '_| / _` |
+//     \__|_||_\___\__|_\_\ .__/\___/_|_||_\__|\_/\_/\___/_| |_\__,_|
+//                        |_|                                        
+// Write a checkpoint once checkpointInterval seconds have been simulated since the last one
+/* On Linux the process forks and the child saves the snapshot while this process keeps simulating. fork() only copies
+   the page tables, the child sees the world frozen at the fork and pages are only copied when the parent writes to
+   them, so the frame isn't held up by serializing or by the disk. The child only has this thread, which is fine since
+   saveSnapshot doesn't use the job system, and leaves with _exit so it doesn't run any of the parent's cleanup.
+   One writer at a time: if the last one hasn't finished the checkpoint waits for the next frame.
+   Everywhere else the snapshot is written right here. Files go to a .tmp name first and are renamed when complete,
+   so a checkpoint file is never half written */
+void checkpointWorld()
+{
+#if defined(PHYSICS_FORK_CHECKPOINTS)
+	if (checkpointWriter != 0)
+	{
+		int status;
+		if (waitpid(checkpointWriter, &status, WNOHANG) == 0) return; // Still writing
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) TraceLog(LOG_WARNING, "CHECKPOINT: Writer process failed");
+		checkpointWriter = 0;
+	}
+#endif
+	if (!checkpointing || simTime < nextCheckpoint) return;
+	nextCheckpoint = simTime + checkpointInterval;
+
+	double start = GetTime();
+	const char* fileName = TextFormat("%s/checkpoint_%i.snap", CHECKPOINT_DIRECTORY, checkpointsWritten % CHECKPOINT_SLOTS);
+	string finalName = fileName; // TextFormat's buffers get reused
+	string tempName = finalName + ".tmp";
+	checkpointsWritten++;
+	if (!DirectoryExists(CHECKPOINT_DIRECTORY)) MakeDirectory(CHECKPOINT_DIRECTORY);
+
+	auto writeCheckpoint = [&]() {
+		vector<unsigned char> blob;
+		saveWorld(blob);
+		if (!SaveFileData(tempName.c_str(), blob.data(), (int)blob.size())) return false;
+		remove(finalName.c_str()); // rename won't replace an existing file everywhere
+		return rename(tempName.c_str(), finalName.c_str()) == 0;
+	};
+#if defined(PHYSICS_FORK_CHECKPOINTS)
+	pid_t child = fork();
+	if (child == 0) _exit(writeCheckpoint() ? 0 : 1);
+	if (child > 0) checkpointWriter = child;
+	else if (!writeCheckpoint()) TraceLog(LOG_WARNING, "CHECKPOINT: Couldn't write %s", finalName.c_str()); // fork failed, write it ourselves
+#else
+	if (!writeCheckpoint()) TraceLog(LOG_WARNING, "CHECKPOINT: Couldn't write %s", finalName.c_str());
+#endif
+	checkpointMilliseconds = (float)((GetTime() - start) * 1000.0);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                 ___ _           _             _     _   
+//      _ _ ___ ____  _ _ __  ___ / __| |_  ___ __| |___ __  ___(_)_ _| |_ 
+//     | '_/ -_|_-< || | '  \/ -_) (__| ' \/ -_) _| / / '_ \/ _ \ | ' \  _|
+//     |_| \___/__/\_,_|_|_|_\___|\___|_||_\___\__|_\_\ .__/\___/_|_||_\__|
+//                                                    |_|                  
+// Restore the newest checkpoint that loads, returns false if there isn't one
+/* A file that's been cut short, damaged on disk or written by another version fails loadSnapshot's checksum and index
+   checks before anything is applied, so the world is untouched and the next older checkpoint gets its turn */
+bool resumeCheckpoint()
+{
+	vector<pair<long, int>> files; // Modification time and slot of every checkpoint on disk
+	for (int slot = 0; slot < CHECKPOINT_SLOTS; slot++) {
+		const char* fileName = TextFormat("%s/checkpoint_%i.snap", CHECKPOINT_DIRECTORY, slot);
+		if (FileExists(fileName)) files.push_back({ GetFileModTime(fileName), slot });
+	}
+	sort(files.rbegin(), files.rend()); // Newest first
+	for (int k = 0; k < files.size(); k++) {
+		const char* fileName = TextFormat("%s/checkpoint_%i.snap", CHECKPOINT_DIRECTORY, files[k].second);
+		int size = 0;
+		unsigned char* data = LoadFileData(fileName, &size);
+		if (data == nullptr) continue;
+		vector<unsigned char> blob(data, data + size);
+		UnloadFileData(data);
+		if (!restoreWorld(blob))
+		{
+			TraceLog(LOG_WARNING, "CHECKPOINT: %s is damaged or from another version, trying an older one", fileName);
+			continue;
+		}
+		TraceLog(LOG_INFO, "CHECKPOINT: Resumed from %s at %.1f s", fileName, simTime);
+		nextCheckpoint = simTime + checkpointInterval;
+		checkpointsWritten = files[k].second + 1; // Next one goes in the slot after it, so it isn't overwritten first
+		return true;
+	}
+	return false;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+//                     _         _ ___       __  __         
+//      _ _ _____ __ _(_)_ _  __| | _ )_  _ / _|/ _|___ _ _ 
+//     | '_/ -_) V  V / | ' \/ _` | _ \ || |  _|  _/ -_) '_|
+//     |_| \___|\_/\_/|_|_||_\__,_|___/\_,_|_| |_| \___|_|  
+//                                                          
+// The last few seconds of steps, kept while X is on so Z can pause and scrub back through them
+/* History is a ring of segments. A segment starts with a keyframe (a full snapshot) and then holds one delta frame per
+   step: every body's position and velocity as a difference from its base, quantized to 16 bits, plus its flags.
+   That's 9 bytes a body instead of a whole snapshot, and every frame decodes straight from the bases so rounding
+   never builds up. Bodies are followed by handle: a frame lists the bodies that left since the one before and keeps a
+   full copy of each body that arrived, which is that body's base. show() replays those entries on top of the keyframe
+   the way the step made them (spawns first, then cleanupWorld's removals), so a stream of spawns costs a copy of each
+   new body rather than a keyframe every step. A new segment starts every REWIND_KEYFRAME_STEPS steps, or when a
+   difference doesn't fit in 16 bits or one of the caller's external bodies comes or goes.
+   The oldest segments are dropped, and their memory given back, once they're further back than seconds or the buffer
+   holds more than budget bytes, the newest segment is always kept. Shown delta frames are only as exact as the
+   quantization, resuming from one carries on from that rounded state */
+const int REWIND_SEGMENTS = 96; // Enough for 10 s at 240 Hz
+const int REWIND_KEYFRAME_STEPS = 30;
+const float REWIND_POSITION_STEP = 1.0f / 16.0f; // Pixels per quantized unit, deltas reach 2048 px from the base
+const float REWIND_VELOCITY_STEP = 1.0f / 8.0f; // Pixels per second per quantized unit, reaches 4096 px/s
+
+class rewindBuffer
+{
+public:
+	float seconds = 10.0f; // How far back the buffer reaches
+	size_t budget = (size_t)256 << 20; // Bytes the buffer may hold before the oldest segments go, 9 bytes a body a step
+
+	// Record the world as it is after a step
+	void record()
+	{
+		if (count > 0 && simTime <= newestTime()) clear(); // Time went backwards (a snapshot was restored), the history after it never happened
+		if (count == 0 || !appendDelta(ring[newest()])) startSegment();
+		// Drop segments that have fallen out of reach or over budget, keeping the one the reach starts in
+		while (count > 1 && (ring[(oldest + 1) % REWIND_SEGMENTS].times[0] <= simTime - seconds || bytes() > budget)) dropOldest();
+	}
+
+	// Put the world back to the last recorded frame at or before time, returns false if nothing is recorded
+	bool show(float time)
+	{
+		int segmentIndex, frame;
+		if (!find(time, &segmentIndex, &frame)) return false;
+		segment& seg = ring[segmentIndex];
+		if (!restoreWorld(seg.keyframe)) return false;
+		shownLive.resize(seg.keyframeBodies);
+		for (int i = 0; i < seg.keyframeBodies; i++) shownLive[i] = i;
+		for (int k = 0; k < frame; k++) replayChanges(seg, k);
+		if (frame > 0) {
+			physicsBodies& bodies = world.bodies;
+			const short* delta = &seg.deltas[seg.frames[frame - 1].deltaStart * 4];
+			const unsigned char* flags = &seg.flags[seg.frames[frame - 1].deltaStart];
+			/* Delta frames don't keep the sleep state, so it's rebuilt from the flags: the inverse mass follows
+			   BODY_ASLEEP, rest timers start over, and every sleeping body goes in one new island so the first touch wakes
+			   them all together and updateSleep sorts them back into their own islands */
+			unsigned int sleepingIsland = ++world.islandCount;
+			for (int i = 0; i < bodies.size(); i++) {
+				int r = shownLive[i];
+				bodies.positionX[i] = seg.baseX[r] + delta[i * 4 + 0] * REWIND_POSITION_STEP;
+				bodies.positionY[i] = seg.baseY[r] + delta[i * 4 + 1] * REWIND_POSITION_STEP;
+				bodies.velocityX[i] = seg.baseVelocityX[r] + delta[i * 4 + 2] * REWIND_VELOCITY_STEP;
+				bodies.velocityY[i] = seg.baseVelocityY[r] + delta[i * 4 + 3] * REWIND_VELOCITY_STEP;
+				bodies.previousX[i] = bodies.positionX[i]; // Nothing to blend from
+				bodies.previousY[i] = bodies.positionY[i];
+				bodies.flags[i] = flags[i];
+				bodies.updateInverseMass(i);
+				bodies.sleepTimer[i] = 0;
+				bodies.island[i] = (flags[i] & BODY_ASLEEP) ? sleepingIsland : 0;
+			}
+			simTime = seg.times[frame];
+		}
+		shownSegment = segmentIndex;
+		shownFrame = frame;
+		return true;
+	}
+
+	// Forget every frame after the one show() put back, the simulation carries on from there instead
+	void discardAfterShown()
+	{
+		if (shownSegment < 0) return;
+		segment& seg = ring[shownSegment];
+		if (shownFrame < seg.frames.size())
+		{
+			frameEntry& next = seg.frames[shownFrame]; // First frame that goes
+			seg.deltas.resize(next.deltaStart * 4);
+			seg.flags.resize(next.deltaStart);
+			seg.removed.resize(next.removedStart);
+			seg.resizeRoster(next.spawnedStart);
+			seg.spawns.resize((next.spawnedStart - seg.keyframeBodies) * bodyRecordBytes());
+			seg.frames.resize(shownFrame);
+		}
+		seg.times.resize(shownFrame + 1);
+		seg.live = shownLive;
+		while (count > (shownSegment - oldest + REWIND_SEGMENTS) % REWIND_SEGMENTS + 1) {
+			ring[newest()] = segment(); // Give the memory back
+			count--;
+		}
+		shownSegment = -1;
+	}
+
+	// Time of the recorded frame steps frames away from the one at or before time, clamped to what's recorded
+	float stepFrom(float time, int steps)
+	{
+		int segmentIndex, frame;
+		if (!find(time, &segmentIndex, &frame)) return time;
+		for (; steps > 0; steps--) {
+			if (frame + 1 < ring[segmentIndex].times.size()) frame++;
+			else if (segmentIndex != newest()) { segmentIndex = (segmentIndex + 1) % REWIND_SEGMENTS; frame = 0; }
+		}
+		for (; steps < 0; steps++) {
+			if (frame > 0) frame--;
+			else if (segmentIndex != oldest) { segmentIndex = (segmentIndex + REWIND_SEGMENTS - 1) % REWIND_SEGMENTS; frame = (int)ring[segmentIndex].times.size() - 1; }
+		}
+		return ring[segmentIndex].times[frame];
+	}
+
+	// Drop everything and give the memory back
+	void clear()
+	{
+		while (count > 0) dropOldest();
+		shownSegment = -1;
+	}
+	bool empty() { return count == 0; }
+	float oldestTime() { return empty() ? simTime : ring[oldest].times[0]; }
+	float newestTime() { return empty() ? simTime : ring[newest()].times.back(); }
+
+	// Memory held by the recorded frames
+	size_t bytes()
+	{
+		size_t total = 0;
+		for (int k = 0; k < count; k++) {
+			total += ring[(oldest + k) % REWIND_SEGMENTS].bytes();
+		}
+		return total;
+	}
+
+private:
+	// Where a delta frame's entries start in its segment's arrays, they end where the next frame's start
+	struct frameEntry
+	{
+		int deltaStart; // First body in deltas and flags
+		int removedStart; // First entry in removed
+		int spawnedStart; // Roster entry of the first body that arrived
+	};
+
+	struct segment
+	{
+		vector<unsigned char> keyframe; // saveWorld blob
+		int keyframeBodies = 0; // The first roster entries are the keyframe's bodies, in slot order
+		// Roster, every body that was in the world at some point in the segment
+		vector<unsigned int> handles; // Handle slot and generation the body had
+		vector<unsigned int> generations;
+		vector<unsigned char> external; // Belongs to the caller, its arrival or removal needs a keyframe
+		vector<float> baseX; // Position and velocity the deltas are measured from, from the keyframe or when it arrived
+		vector<float> baseY;
+		vector<float> baseVelocityX;
+		vector<float> baseVelocityY;
+		vector<unsigned char> spawns; // Every array's value for each body that arrived after the keyframe, for show() to add
+		vector<int> live; // Roster entry of each body in the world after the newest frame, in slot order
+		vector<float> times; // simTime of the keyframe, then of each delta frame
+		vector<frameEntry> frames; // One per delta frame
+		vector<int> removed; // Roster entries of the bodies that left, frame after frame
+		vector<short> deltas; // x, y, velocity x, velocity y for every body, one frame after another
+		vector<unsigned char> flags; // Every body's flags, one frame after another
+
+		void resizeRoster(int size)
+		{
+			handles.resize(size);
+			generations.resize(size);
+			external.resize(size);
+			baseX.resize(size);
+			baseY.resize(size);
+			baseVelocityX.resize(size);
+			baseVelocityY.resize(size);
+		}
+
+		size_t bytes()
+		{
+			return keyframe.capacity() + handles.capacity() * (2 * sizeof(unsigned int) + 1 + 4 * sizeof(float)) + spawns.capacity()
+				+ live.capacity() * sizeof(int) + times.capacity() * sizeof(float) + frames.capacity() * sizeof(frameEntry)
+				+ removed.capacity() * sizeof(int) + deltas.capacity() * sizeof(short) + flags.capacity();
+		}
+	};
+
+	segment ring[REWIND_SEGMENTS];
+	int oldest = 0;
+	int count = 0;
+	int shownSegment = -1; // Where show() last went, -1 once the simulation has moved on
+	int shownFrame = 0;
+	vector<int> shownLive; // Roster entry of each body show() put in the world
+	vector<int> nextLive; // Scratch for appendDelta
+	vector<int> leaving;
+	vector<unsigned char> gone; // Scratch for replayChanges
+	vector<unsigned char> mask;
+	vector<physicObject*> views;
+
+	int newest() { return (oldest + count - 1) % REWIND_SEGMENTS; }
+
+	void dropOldest()
+	{
+		ring[oldest] = segment(); // Give the memory back
+		oldest = (oldest + 1) % REWIND_SEGMENTS;
+		count--;
+	}
+
+	// Size of one body over all the arrays
+	static size_t bodyRecordBytes()
+	{
+		size_t total = 0;
+		world.bodies.forEachArray([&](auto& values) { total += sizeof(values[0]); });
+		return total;
+	}
+
+	void startSegment()
+	{
+		if (count == REWIND_SEGMENTS) dropOldest(); // Full, reuse the oldest
+		count++;
+		segment& seg = ring[newest()];
+		physicsBodies& bodies = world.bodies;
+		int n = bodies.size();
+		saveWorld(seg.keyframe);
+		seg.keyframeBodies = n;
+		seg.resizeRoster(0);
+		seg.spawns.clear();
+		seg.live.resize(n);
+		for (int i = 0; i < n; i++) {
+			addToRoster(seg, i);
+			seg.live[i] = i;
+		}
+		seg.times.assign(1, simTime);
+		seg.frames.clear();
+		seg.removed.clear();
+		seg.deltas.clear();
+		seg.flags.clear();
+		shownSegment = -1;
+	}
+
+	// Add body i as the next roster entry, with where it is now as its base
+	void addToRoster(segment& seg, int i)
+	{
+		physicsBodies& bodies = world.bodies;
+		seg.handles.push_back(bodies.handle[i]);
+		seg.generations.push_back(world.handleGeneration[bodies.handle[i]]);
+		seg.external.push_back((bodies.flags[i] & BODY_EXTERNAL) ? 1 : 0);
+		seg.baseX.push_back(bodies.positionX[i]);
+		seg.baseY.push_back(bodies.positionY[i]);
+		seg.baseVelocityX.push_back(bodies.velocityX[i]);
+		seg.baseVelocityY.push_back(bodies.velocityY[i]);
+	}
+
+	// Add the current step to seg as a delta frame, false if it has to be a new keyframe instead
+	bool appendDelta(segment& seg)
+	{
+		physicsBodies& bodies = world.bodies;
+		int n = bodies.size();
+		if (seg.times.size() >= REWIND_KEYFRAME_STEPS) return false;
+		// Removals keep the order of the bodies that stay and spawns go on the end, so one walk finds who left and who arrived
+		nextLive.clear();
+		leaving.clear();
+		int stayed = 0;
+		for (int r : seg.live) {
+			unsigned int slot = (stayed < n) ? bodies.handle[stayed] : 0;
+			if (stayed < n && slot == seg.handles[r] && world.handleGeneration[slot] == seg.generations[r])
+			{
+				nextLive.push_back(r);
+				stayed++;
+			}
+			else if (seg.external[r]) return false;
+			else leaving.push_back(r);
+		}
+		for (int i = stayed; i < n; i++) {
+			if (bodies.flags[i] & BODY_EXTERNAL) return false;
+		}
+
+		size_t start = seg.deltas.size();
+		seg.deltas.resize(start + n * 4, 0); // Bodies that just arrived are their own base, their deltas stay 0
+		short* delta = &seg.deltas[start];
+		for (int i = 0; i < stayed; i++) {
+			int r = nextLive[i];
+			if (!quantize(bodies.positionX[i] - seg.baseX[r], REWIND_POSITION_STEP, &delta[i * 4 + 0])
+				|| !quantize(bodies.positionY[i] - seg.baseY[r], REWIND_POSITION_STEP, &delta[i * 4 + 1])
+				|| !quantize(bodies.velocityX[i] - seg.baseVelocityX[r], REWIND_VELOCITY_STEP, &delta[i * 4 + 2])
+				|| !quantize(bodies.velocityY[i] - seg.baseVelocityY[r], REWIND_VELOCITY_STEP, &delta[i * 4 + 3])) {
+				seg.deltas.resize(start);
+				return false;
+			}
+		}
+
+		seg.frames.push_back({ (int)(start / 4), (int)seg.removed.size(), (int)seg.handles.size() });
+		seg.removed.insert(seg.removed.end(), leaving.begin(), leaving.end());
+		for (int i = stayed; i < n; i++) {
+			nextLive.push_back((int)seg.handles.size());
+			addToRoster(seg, i);
+			bodies.forEachArray([&](auto& values) {
+				const unsigned char* value = (const unsigned char*)&values[i];
+				seg.spawns.insert(seg.spawns.end(), value, value + sizeof(values[0]));
+			});
+		}
+		seg.live.swap(nextLive);
+		seg.flags.insert(seg.flags.end(), bodies.flags.begin(), bodies.flags.end());
+		seg.times.push_back(simTime);
+		shownSegment = -1;
+		return true;
+	}
+
+	// Redo delta frame k's spawns and removals on the world show() is rebuilding, shownLive follows along
+	void replayChanges(segment& seg, int k)
+	{
+		physicsBodies& bodies = world.bodies;
+		frameEntry& entry = seg.frames[k];
+		bool last = (k + 1 == seg.frames.size());
+		int spawnedEnd = last ? (int)seg.handles.size() : seg.frames[k + 1].spawnedStart;
+		int removedEnd = last ? (int)seg.removed.size() : seg.frames[k + 1].removedStart;
+		size_t recordBytes = bodyRecordBytes();
+		for (int r = entry.spawnedStart; r < spawnedEnd; r++) {
+			physicsCircle* circle = circlePool.acquire();
+			world.addObject(circle);
+			int i = circle->index;
+			const unsigned char* record = &seg.spawns[(r - seg.keyframeBodies) * recordBytes];
+			bodies.forEachArray([&](auto& values) {
+				// The world gave it a handle of its own, and it has no tree proxy until the next step makes one
+				if ((const void*)&values != (const void*)&bodies.handle && (const void*)&values != (const void*)&bodies.proxyId)
+					memcpy(&values[i], record, sizeof(values[0]));
+				record += sizeof(values[0]);
+			});
+			shownLive.push_back(r);
+		}
+		if (entry.removedStart == removedEnd) return;
+
+		gone.assign(seg.handles.size(), 0);
+		for (int e = entry.removedStart; e < removedEnd; e++) {
+			gone[seg.removed[e]] = 1;
+		}
+		mask.resize(bodies.size());
+		views.clear();
+		int kept = 0;
+		for (int i = 0; i < bodies.size(); i++) {
+			mask[i] = gone[shownLive[i]];
+			if (mask[i]) views.push_back(world.objects[i]);
+			else shownLive[kept++] = shownLive[i];
+		}
+		shownLive.resize(kept);
+		world.removeObjects(mask.data());
+		for (physicObject* view : views) {
+			circlePool.release((physicsCircle*)view);
+		}
+	}
+
+	// Round difference to a multiple of step, false if that doesn't fit in a short (or difference is NaN)
+	static bool quantize(float difference, float step, short* result)
 	{
-		DrawCircle(position.x, position.y, 8, RED); // Draw arbitrary line based on position and rotation
-		DrawLineEx(position, position + normal * 30, 1, RED); // Draw normal vector
-		Vector2 parrellelToSurface = Vector2Rotate(normal, PI * 0.5f);// Rotate function, takes radians. 360 degrees = 2PI radians
-		DrawLineEx(position - parrellelToSurface * 4000, position + parrellelToSurface * 4000, 1, RED); // Draw surface line
+		float units = roundf(difference / step);
+		if (!(units >= -32767.0f && units <= 32767.0f)) return false;
+		*result = (short)units;
+		return true;
 	}
 
-	ObjectType Shape() override
+	// Segment and frame of the last recorded frame at or before time, the oldest frame if time is before all of them
+	bool find(float time, int* segmentIndex, int* frame)
 	{
-		return HALFSPACE;
+		if (empty()) return false;
+		int k = count - 1;
+		while (k > 0 && ring[(oldest + k) % REWIND_SEGMENTS].times[0] > time) k--;
+		*segmentIndex = (oldest + k) % REWIND_SEGMENTS;
+		vector<float>& times = ring[*segmentIndex].times;
+		*frame = (int)(upper_bound(times.begin(), times.end(), time) - times.begin()) - 1;
+		if (*frame < 0) *frame = 0;
+		return true;
 	}
 };
-//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-//     __      __            .__       .___
-//    /  \    /  \___________|  |    __| _/
-//    \   \/\/   /  _ \_  __ \  |   / __ | 
-//     \        (  <_> )  | \/  |__/ /_/ | 
-//      \__/\  / \____/|__|  |____/\____ | 
-//           \/                         \/ 
+// Recent steps for Z to scrub through
+rewindBuffer history;
 
-// Linker functions for collision responses, will be defined later on, just have the declarations here as a placeholder
-bool CircleCircleCollisionResponse(physicsCircle* circleA, physicsCircle* circleB);
-bool CircleHalfspaceCollisionResponse(physicsCircle* circle, physicsHalfspace* halfspace);
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+//         _        _       ___                   _         
+//      __| |_ __ _| |_ ___| _ \___ __ ___ _ _ __| |___ _ _ 
+//     (_-<  _/ _` |  _/ -_)   / -_) _/ _ \ '_/ _` / -_) '_|
+//     /__/\__\__,_|\__\___|_|_\___\__\___/_| \__,_\___|_|  
+//                                                          
+// Writes every step's body positions and velocities to a file for statePlayer to stream back
+/* Made to keep full rate recordings of big scenes small. Every value is quantized to fixed point (STATE_POSITION_SCALE
+   and STATE_VELOCITY_SCALE units per pixel) and stored as the difference from the same slot in the frame before, so a
+   body at rest costs a zero (positions are compared with where the old velocity would have taken them, see predictState,
+   so a body in free flight is nearly free too). Differences are zigzag varints (1 byte up to +-63), grouped field by field rather than
+   body by body so similar numbers sit together, and frames are gathered into chunks that CompressData DEFLATEs.
+   Each chunk starts from zero instead of the frame before, so it decodes on its own and the player only ever holds one.
+   Quantized values are differenced, not the floats, so nothing drifts: the player gets back exactly the quantized
+   values. Compressing and writing happen on a thread of their own, the step only waits if a whole chunk is still
+   being compressed when the next one fills up.
+   File: stateFileHeader, then for each chunk a stateChunkHeader and its compressed bytes. A frame inside a chunk is
+   the body count (varint), simTime (raw float), then the differences of every body's radius, then of every x, ... */
+const unsigned int STATE_MAGIC = 0x54534850; // "PHST"
+const int STATE_VERSION = 1;
+const float STATE_POSITION_SCALE = 16.0f; // Fixed point units per pixel, radii use it too
+const float STATE_VELOCITY_SCALE = 8.0f; // Units per pixel per second
+const int STATE_CHUNK_FRAMES = 60;
+const int STATE_CHUNK_BYTES = 16 * 1024 * 1024; // Before compressing, well under what DecompressData can unpack (MAX_DECOMPRESSION_SIZE)
+const int STATE_FIELDS = 5; // Radius, position x and y, velocity x and y
 
-// Physics World class
-class physicsWorld {
-private:
-	unsigned int objCount = 0;
-public:
+struct stateFileHeader
+{
+	unsigned int magic;
+	int version;
+	float positionScale;
+	float velocityScale;
+	float stepRate; // physicsRate when recording started, for playing back at the same speed
+};
 
-	// Variables for physics world
-	Vector2 gravityAcceleration; // Gravity acceleration vector
-	vector<physicObject*> objects; // All objects in physics world
-	vector<physicsCircle> circles; // Store circles separately for easy access
+struct stateChunkHeader
+{
+	int compressedBytes;
+	int rawBytes;
+	int frames;
+};
 
-	// Functions
+// Round value * scale to an int, clamped so differences between two of them can't overflow (NaN becomes 0)
+int toFixedPoint(float value, float scale)
+{
+	float units = roundf(value * scale);
+	if (!(units > -1073741824.0f)) return (units == units) ? -1073741823 : 0;
+	return (units < 1073741824.0f) ? (int)units : 1073741823;
+}
 
-	/////////////////////////////////////////////////////////////////////////////////////////////////////////
-	//        _      _    _       _     _        _   
-	//       /_\  __| |__| |  ___| |__ (_)___ __| |_ 
-	//      / _ \/ _` / _` | / _ \ '_ \| / -_) _|  _|
-	//     /_/ \_\__,_\__,_| \___/_.__// \___\__|\__|
-	//                               |__/            
-	// Add object to physics world
-	void addObject(physicObject* obj) {
-		obj->name = to_string(objCount);
-		objects.push_back(obj);
-		objCount++;
+// Zigzag (small negative numbers stay small) then 7 bits a byte, high bit set on every byte but the last
+void appendVarint(vector<unsigned char>& out, int value)
+{
+	unsigned int bits = ((unsigned int)value << 1) ^ (unsigned int)(value >> 31);
+	while (bits >= 0x80) {
+		out.push_back((unsigned char)(bits | 0x80));
+		bits >>= 7;
 	}
+	out.push_back((unsigned char)bits);
+}
 
-	/////////////////////////////////////////////////////////////////////////////////////////////////////////
-	//                      _   _  _     _    __                   
-	//      _ _ ___ ___ ___| |_| \| |___| |_ / _|___ _ _ __ ___ ___
-	//     | '_/ -_|_-</ -_)  _| .` / -_)  _|  _/ _ \ '_/ _/ -_|_-<
-	//     |_| \___/__/\___|\__|_|\_\___|\__|_| \___/_| \__\___/__/
-	//                                                             
-	// Reset net forces on all objects
-	void resetNetForces() {
-		for (auto& obj : objects) {
-			obj->netForce = { 0,0 };
+// Read what appendVarint wrote, false if it runs past end
+bool readVarint(const unsigned char*& read, const unsigned char* end, int* value)
+{
+	unsigned int bits = 0;
+	for (int shift = 0; shift < 35; shift += 7) {
+		if (read == end) return false;
+		unsigned char byte = *read++;
+		bits |= (unsigned int)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+		{
+			*value = (int)(bits >> 1) ^ -(int)(bits & 1);
+			return true;
 		}
 	}
+	return false;
+}
 
-	/////////////////////////////////////////////////////////////////////////////////////////////////////////
-	//              _    _  ___              _ _        ___               
-	//      __ _ __| |__| |/ __|_ _ __ ___ _(_) |_ _  _| __|__ _ _ __ ___ 
-	//     / _` / _` / _` | (_ | '_/ _` \ V / |  _| || | _/ _ \ '_/ _/ -_)
-	//     \__,_\__,_\__,_|\___|_| \__,_|\_/|_|\__|\_, |_|\___/_| \__\___|
-	//                                             |__/     
-	// Add gravity force to all objects             
-	void addGravityForce()
+// Guess at value field of slot i this frame from the frame before, positions carry on at the old velocity and the rest
+// stay the same. The recorder only stores how far off the guess was and the player makes the same guess, so bodies in
+// free flight cost as little as bodies at rest. Slots that didn't exist last frame are guessed as 0
+// velocityToPosition turns velocity units into position units moved in one step, from the rate the file was recorded at
+int predictState(const vector<int> (&previous)[STATE_FIELDS], int field, int i, double velocityToPosition)
+{
+	if (i >= previous[field].size()) return 0;
+	unsigned int value = (unsigned int)previous[field][i];
+	if ((field == 1 || field == 2) && i < previous[field + 2].size()) value += (unsigned int)(int)llround(previous[field + 2][i] * velocityToPosition);
+	return (int)value; // Wraps the same way on both sides, so nothing is lost even at the clamped extremes
+}
+
+class stateRecorder
+{
+public:
+	// Create fileName and start the writer thread, false if the file can't be created
+	bool start(const char* fileName)
 	{
-		for (auto* obj : objects) {
-			if (obj->isStatic) continue; // Avoid modifying static objects, if static, skip to next object
-			Vector2 gravityForce = gravityAcceleration * obj->mass; // F = m * a
-			obj->netForce += gravityForce; // Add gravity force to net force
-			DrawLineEx(obj->position, obj->position + gravityForce, 1, PURPLE); // Draw gravity force vector
-		}
+		file = fopen(fileName, "wb");
+		if (file == nullptr) return false;
+		stateFileHeader header = { STATE_MAGIC, STATE_VERSION, STATE_POSITION_SCALE, STATE_VELOCITY_SCALE, physicsRate };
+		fwrite(&header, sizeof(header), 1, file);
+		bytesWritten = sizeof(header);
+		velocityToPosition = STATE_POSITION_SCALE / (STATE_VELOCITY_SCALE * physicsRate);
+		writer = thread([this]() { writeChunks(); });
+		return true;
 	}
 
-	/////////////////////////////////////////////////////////////////////////////////////////////////////////
-	//                     _      _  ___                     _   _       
-	//      __ _ _ __ _ __| |_  _| |/ (_)_ _  ___ _ __  __ _| |_(_)__ ___
-	//     / _` | '_ \ '_ \ | || | ' <| | ' \/ -_) '  \/ _` |  _| / _(_-<
-	//     \__,_| .__/ .__/_|\_, |_|\_\_|_||_\___|_|_|_\__,_|\__|_\__/__/
-	//          |_|  |_|     |__/                                        
-	// Apply kinematics to all objects
-	void applyKinematics()
+	// Add the bodies as they are after a step
+	void record()
 	{
-		for (auto* obj : objects) {
-			if (obj->isStatic) continue; // Avoid modifying static objects, if static, skip to next object
-			obj->position = obj->position + obj->velocity * dt; // Velocity = change in position over time p/t, therefore change in position = velocity * time
-			Vector2 acceleration = obj->netForce / obj->mass; // F = ma, so a = F/m where F is net force on an object
-			obj->velocity += acceleration * dt; // gravityAcceleration = deltaV / time, therefore deltaV = gravityAcceleration * time
-			DrawLineEx(obj->position, obj->position + obj->netForce, 1, GRAY); // Draw net force vector
+		double start = GetTime();
+		physicsBodies& bodies = world.bodies;
+		int n = bodies.size();
+		for (int i = 0; i < n; i++) {
+			current[0].push_back(toFixedPoint(bodies.radius[i], STATE_POSITION_SCALE));
+			current[1].push_back(toFixedPoint(bodies.positionX[i], STATE_POSITION_SCALE));
+			current[2].push_back(toFixedPoint(bodies.positionY[i], STATE_POSITION_SCALE));
+			current[3].push_back(toFixedPoint(bodies.velocityX[i], STATE_VELOCITY_SCALE));
+			current[4].push_back(toFixedPoint(bodies.velocityY[i], STATE_VELOCITY_SCALE));
 		}
+		appendVarint(raw, n);
+		raw.insert(raw.end(), (unsigned char*)&simTime, (unsigned char*)&simTime + sizeof(float));
+		for (int field = 0; field < STATE_FIELDS; field++) {
+			vector<int>& now = current[field];
+			for (int i = 0; i < n; i++) {
+				appendVarint(raw, (int)((unsigned int)now[i] - (unsigned int)predictState(previous, field, i, velocityToPosition)));
+			}
+		}
+		for (int field = 0; field < STATE_FIELDS; field++) {
+			swap(current[field], previous[field]); // Only now, every field's prediction needed the old velocities
+			current[field].clear();
+		}
+		rawFrames++;
+		framesRecorded++;
+		if (rawFrames == STATE_CHUNK_FRAMES || raw.size() >= STATE_CHUNK_BYTES) flush();
+		milliseconds = (float)((GetTime() - start) * 1000.0);
 	}
 
-	/////////////////////////////////////////////////////////////////////////////////////////////////////////
-	//         _           _    ___     _ _ _              
-	//      __| |_  ___ __| |__/ __|___| | (_)___ ___ _ _  
-	//     / _| ' \/ -_) _| / / (__/ _ \ | | (_-</ _ \ ' \ 
-	//     \__|_||_\___\__|_\_\\___\___/_|_|_/__/\___/_||_|
-	//                                                     
-	// Check for collisions between objects
-	void checkCollision()
+	// Write what's left and close the file
+	void stop()
 	{
-		vector<bool> collided(objects.size(), false); // Track which objects have collided
-		for (int i = 0; i < objects.size(); i++) {
-			for (int j = i + 1; j < objects.size(); j++) { // Start checking from the next object, no need to check previous objects again
-
-				// Pointers to objects
-				physicObject* objpointerA = objects[i];
-				physicObject* objpointerB = objects[j];
-				bool didCollide = false;
+		if (file == nullptr) return;
+		flush();
+		{
+			lock_guard<mutex> guard(lock);
+			stopping = true;
+		}
+		changed.notify_all();
+		writer.join();
+		fclose(file);
+		file = nullptr;
+	}
 
-				// Ask Objects what shape they are
-				ObjectType shapeofA = objpointerA->Shape();
-				ObjectType shapeofB = objpointerB->Shape();
+	bool recording() { return file != nullptr; }
+	int frames() { return framesRecorded; }
+	long long bytes() { return bytesWritten; }
+	float frameMilliseconds() { return milliseconds; } // Time the step loop spent in the last record()
 
-				// Call appropriate collision response function based on object shapes
-				if (shapeofA == CIRCLE && shapeofB == CIRCLE)
-				{
-					didCollide = CircleCircleCollisionResponse((physicsCircle*)objpointerA, (physicsCircle*)objpointerB);
-				}
-				else if (shapeofA == CIRCLE && shapeofB == HALFSPACE)
-				{
-					didCollide = CircleHalfspaceCollisionResponse((physicsCircle*)objpointerA, (physicsHalfspace*)objpointerB);
-				}
-				else if (shapeofA == HALFSPACE && shapeofB == CIRCLE)
-				{
-					didCollide = CircleHalfspaceCollisionResponse((physicsCircle*)objpointerB, (physicsHalfspace*)objpointerA);
-				}
+private:
+	FILE* file = nullptr;
+	vector<int> previous[STATE_FIELDS]; // Quantized values of the last frame in the chunk, what the next frame is stored against
+	vector<int> current[STATE_FIELDS];
+	vector<unsigned char> raw; // Chunk being filled
+	int rawFrames = 0;
+	int framesRecorded = 0;
+	float milliseconds = 0;
+	double velocityToPosition = 0; // See predictState
+	atomic<long long> bytesWritten{ 0 };
 
-				// Mark objects as collided if a collision occurred
-				if (didCollide)
-				{
-					collided[i] = true;
-					collided[j] = true;
-				}
-			}
-		}
+	thread writer;
+	mutex lock;
+	condition_variable changed;
+	vector<unsigned char> pending; // Full chunk waiting for the writer
+	int pendingFrames = 0;
+	bool stopping = false;
 
-		// Update object colors based on collision status
-		for (int i = 0; i < collided.size(); i++)
+	// Hand the chunk to the writer, waiting if it's still busy with the last one
+	void flush()
+	{
+		if (rawFrames == 0) return;
 		{
-			if (collided[i])
-			{
-				objects[i]->color = RED;
-			}
-			else
-			{
-				objects[i]->color = GREEN;
-			}
+			unique_lock<mutex> guard(lock);
+			changed.wait(guard, [this]() { return pendingFrames == 0; });
+			swap(pending, raw);
+			pendingFrames = rawFrames;
 		}
+		changed.notify_all();
+		raw.clear();
+		rawFrames = 0;
+		for (vector<int>& values : previous) values.clear(); // The next chunk starts from zero
 	}
 
-	/////////////////////////////////////////////////////////////////////////////////////////////////////////
-	//                    _      _        ___  _     _        _   
-	//      _  _ _ __  __| |__ _| |_ ___ / _ \| |__ (_)___ __| |_ 
-	//     | || | '_ \/ _` / _` |  _/ -_) (_) | '_ \| / -_) _|  _|
-	//      \_,_| .__/\__,_\__,_|\__\___|\___/|_.__// \___\__|\__|
-	//          |_|                               |__/ 
-	// Updatephysics world for one time step, order of operations matters          
-	void updateObject() {
-		resetNetForces(); // Set net force variable to 0, [physicObject.netForce] tracks all forces applying to it in one frame
-		addGravityForce(); // Add Gravity Force
-		checkCollision(); // Apply collision detection and response, add Normal force if applicable
-		applyKinematics(); // Accerates and moves objects according to a = F/m and kinematics equations
+	void writeChunks()
+	{
+		unique_lock<mutex> guard(lock);
+		while (true)
+		{
+			changed.wait(guard, [this]() { return pendingFrames > 0 || stopping; });
+			if (pendingFrames == 0) return; // Stopping and nothing left
+			guard.unlock();
+			int compressedBytes = 0;
+			unsigned char* compressed = CompressData(pending.data(), (int)pending.size(), &compressedBytes);
+			stateChunkHeader header = { compressedBytes, (int)pending.size(), pendingFrames };
+			fwrite(&header, sizeof(header), 1, file);
+			fwrite(compressed, 1, compressedBytes, file);
+			MemFree(compressed);
+			bytesWritten += sizeof(header) + compressedBytes;
+			guard.lock();
+			pendingFrames = 0;
+			changed.notify_all();
+		}
 	}
 };
 
-// Define global physics world
-physicsWorld world;
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+//         _        _       ___ _                   
+//      __| |_ __ _| |_ ___| _ \ |__ _ _  _ ___ _ _ 
+//     (_-<  _/ _` |  _/ -_)  _/ / _` | || / -_) '_|
+//     /__/\__\__,_|\__\___|_| |_\__,_|\_, \___|_|  
+//                                     |__/         
+// Streams a file written by stateRecorder back one frame at a time, only the chunk being played is in memory
+class statePlayer
+{
+public:
+	// The frame nextFrame() decoded
+	vector<float> radius;
+	vector<float> positionX;
+	vector<float> positionY;
+	vector<float> velocityX;
+	vector<float> velocityY;
+	float frameTime = 0; // simTime the frame was recorded at
+	int frame = -1; // Frames into the file
+	float stepRate = 60;
 
-// Define global halfspace
-physicsHalfspace halfspace;
-physicsHalfspace halfspace_2;
+	// Open fileName and check its header, false if it isn't a state recording this version can read
+	bool open(const char* fileName)
+	{
+		file = fopen(fileName, "rb");
+		if (file == nullptr) return false;
+		stateFileHeader header;
+		if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != STATE_MAGIC || header.version != STATE_VERSION || header.stepRate <= 0)
+		{
+			close();
+			return false;
+		}
+		positionScale = header.positionScale;
+		velocityScale = header.velocityScale;
+		stepRate = header.stepRate;
+		velocityToPosition = positionScale / (velocityScale * stepRate);
+		restart();
+		return true;
+	}
 
-//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//    _________        .__  .__  .__                   __________                                                    ___________                   __  .__                      
-//    \_   ___ \  ____ |  | |  | |__| __________   ____\______   \ ____   ____________   ____   ____   ______ ____   \_   _____/_ __  ____   _____/  |_|__| ____   ____   ______
-//    /    \  \/ /  _ \|  | |  | |  |/  ___/  _ \ /    \|       _// __ \ /  ___/\____ \ /  _ \ /    \ /  ___// __ \   |    __)|  |  \/    \_/ ___\   __\  |/  _ \ /    \ /  ___/
-//    \     \___(  <_> )  |_|  |_|  |\___ (  <_> )   |  \    |   \  ___/ \___ \ |  |_> >  <_> )   |  \\___ \\  ___/   |     \ |  |  /   |  \  \___|  | |  (  <_> )   |  \\___ \ 
-//     \______  /\____/|____/____/__/____  >____/|___|  /____|_  /\___  >____  >|   __/ \____/|___|  /____  >\___  >  \___  / |____/|___|  /\___  >__| |__|\____/|___|  /____  >
-//            \/                         \/           \/       \/     \/     \/ |__|               \/     \/     \/       \/             \/     \/                    \/     \/     
+	// Go back to the first frame
+	void restart()
+	{
+		fseek(file, sizeof(stateFileHeader), SEEK_SET);
+		chunk.clear();
+		read = 0;
+		framesLeft = 0;
+		frame = -1;
+	}
 
+	// Decode the next frame, false at the end of the file or at a damaged chunk
+	bool nextFrame()
+	{
+		if (file == nullptr) return false;
+		if (framesLeft == 0 && !readChunk()) return false;
+		const unsigned char* start = chunk.data() + read;
+		const unsigned char* end = chunk.data() + chunk.size();
+		const unsigned char* cursor = start;
+		int n;
+		if (!readVarint(cursor, end, &n) || n < 0 || end - cursor < sizeof(float)) return false;
+		memcpy(&frameTime, cursor, sizeof(float));
+		cursor += sizeof(float);
+		for (int field = 0; field < STATE_FIELDS; field++) {
+			vector<int>& values = current[field];
+			values.resize(n);
+			for (int i = 0; i < n; i++) {
+				int delta;
+				if (!readVarint(cursor, end, &delta)) return false;
+				values[i] = (int)((unsigned int)predictState(previous, field, i, velocityToPosition) + (unsigned int)delta);
+			}
+		}
+		for (int field = 0; field < STATE_FIELDS; field++) {
+			swap(current[field], previous[field]);
+		}
+		read += cursor - start;
+		framesLeft--;
+		frame++;
+		fromFixedPoint(previous[0], positionScale, radius);
+		fromFixedPoint(previous[1], positionScale, positionX);
+		fromFixedPoint(previous[2], positionScale, positionY);
+		fromFixedPoint(previous[3], velocityScale, velocityX);
+		fromFixedPoint(previous[4], velocityScale, velocityY);
+		return true;
+	}
 
+	void close()
+	{
+		if (file != nullptr) fclose(file);
+		file = nullptr;
+	}
 
+	bool playing() { return file != nullptr; }
 
-	/////////////////////////////////////////////////////////////////////////////////////////////////////////
-	//       ___ _        _      ___ _        _      ___     _ _ _    _          ___                               
-	//      / __(_)_ _ __| |___ / __(_)_ _ __| |___ / __|___| | (_)__(_)___ _ _ | _ \___ ____ __  ___ _ _  ___ ___ 
-	//     | (__| | '_/ _| / -_) (__| | '_/ _| / -_) (__/ _ \ | | (_-< / _ \ ' \|   / -_|_-< '_ \/ _ \ ' \(_-</ -_)
-	//      \___|_|_| \__|_\___|\___|_|_| \__|_\___|\___\___/_|_|_/__/_\___/_||_|_|_\___/__/ .__/\___/_||_/__/\___|
-	//                                                                                     |_| 
-	//                                         Circle-Circle Collision Response                   
-bool CircleCircleCollisionResponse(physicsCircle* circleA, physicsCircle* circleB)
-{
-	Vector2 displacementFromAtoB = Vector2Subtract(circleB->position, circleA->position); // Same thing as circleB.position - circleA.position
-	float distance = Vector2Length(displacementFromAtoB); // Use pythagorean thoreom to get magnitude of displacement vector betwen circles
-	float sumOfRadii = circleA->radius + circleB->radius;
-	float overlap = sumOfRadii - distance; // Sum of radii = 5, distance = 10, overlap = -5 (no overlap)
+private:
+	FILE* file = nullptr;
+	float positionScale = STATE_POSITION_SCALE;
+	float velocityScale = STATE_VELOCITY_SCALE;
+	vector<unsigned char> chunk; // Decompressed chunk being played
+	size_t read = 0; // Where the next frame starts in chunk
+	int framesLeft = 0;
+	vector<int> previous[STATE_FIELDS]; // Quantized values of the last frame decoded
+	vector<int> current[STATE_FIELDS];
+	double velocityToPosition = 0; // See predictState
 
+	bool readChunk()
+	{
+		stateChunkHeader header;
+		if (fread(&header, sizeof(header), 1, file) != 1 || header.compressedBytes <= 0 || header.frames <= 0) return false;
+		vector<unsigned char> compressed(header.compressedBytes);
+		if (fread(compressed.data(), 1, compressed.size(), file) != compressed.size()) return false;
+		int rawBytes = 0;
+		unsigned char* data = DecompressData(compressed.data(), (int)compressed.size(), &rawBytes);
+		if (data == nullptr) return false;
+		chunk.assign(data, data + rawBytes);
+		MemFree(data);
+		if (rawBytes != header.rawBytes) return false;
+		read = 0;
+		framesLeft = header.frames;
+		for (vector<int>& values : previous) values.clear();
+		return true;
+	}
 
-	if (overlap > 0) // if overlap is positive, we have collision
+	static void fromFixedPoint(const vector<int>& units, float scale, vector<float>& values)
 	{
-		Vector2 normal = displacementFromAtoB / distance; // Normalize displacement vector to get collision normal
-		Vector2 mtv = normal * overlap; // minimum translation vector (to move objects out of collision)
-		circleA->position -= mtv * 0.5f;
-		circleB->position += mtv * 0.5f;
-		return true; // Overlapping
+		values.resize(units.size());
+		for (int i = 0; i < units.size(); i++) {
+			values[i] = units[i] / scale;
+		}
 	}
-	else
-		return false; // Not overlapping
+};
+
+// --record-states and --play-states
+stateRecorder recorder;
+statePlayer player;
+float playbackAccumulator = 0; // Real time that hasn't been played back yet
+
+// Velocity new circles are launched with, from the speed and angle sliders (angle counts up anticlockwise, screen y points down)
+Vector2 launchVelocity()
+{
+	float sine, cosine;
+	physicsSinCos(angle * DEG2RAD, &sine, &cosine);
+	return { cosine * speed, -sine * speed };
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
-//       ___ _        _     _  _      _  __                       ___     _ _ _    _          ___                               
-//      / __(_)_ _ __| |___| || |__ _| |/ _|____ __  __ _ __ ___ / __|___| | (_)__(_)___ _ _ | _ \___ ____ __  ___ _ _  ___ ___ 
-//     | (__| | '_/ _| / -_) __ / _` | |  _(_-< '_ \/ _` / _/ -_) (__/ _ \ | | (_-< / _ \ ' \|   / -_|_-< '_ \/ _ \ ' \(_-</ -_)
-//      \___|_|_| \__|_\___|_||_\__,_|_|_| /__/ .__/\__,_\__\___|\___\___/_|_|_/__/_\___/_||_|_|_\___/__/ .__/\___/_||_/__/\___|
-//                                            |_|                                                       |_|                     
-//										Circle-Halfspace Collision Response
-bool CircleHalfspaceCollisionResponse(physicsCircle* circle, physicsHalfspace* halfspace)
-{
-	Vector2 displacementFromHalfspaceToCircle = Vector2Subtract(circle->position, halfspace->position); // Same thing as circleB.position - circleA.position
-	float dot = Vector2DotProduct(displacementFromHalfspaceToCircle, halfspace->getNormal());
-	Vector2 projectionDisplacementOntoNormal = halfspace->getNormal() * dot; // If normal is already normalized, we dont need to do the whole equation for vector projection
+//         _            _   ___            _          
+//      __| |_ __ _ _ _| |_/ __| ___ _____(_)___ _ _  
+//     (_-<  _/ _` | '_|  _\__ \/ -_|_-<_-< / _ \ ' \ 
+//     /__/\__\__,_|_|  \__|___/\___/__/__/_\___/_||_|
+//                                                    
+// Begin recording or replaying, after the window is open
+/* raylib records input as automation events, each tagged with the frame it happened on: keys (the SPACE and C spawns,
+   the toggles) and the mouse, which is all raygui needs to replay slider drags. A replay plays every event at the start
+   of the frame it was recorded on, before update() polls the keys.
+   For the same input to always land on the same physics step, both modes start from a fresh world (no checkpoint
+   resume) and advance exactly 1 / TARGET_FPS per frame, see frameSeconds. Replays also turn off the frame limiter and
+   time every frame and every step stage, finishSession reports them. Keep the mouse out of the window during a replay,
+   real input still gets through */
+AutomationEventList sessionEvents;
+int nextSessionEvent = 0; // Next event to play
 
-	//DRAW LINE FROM CIRCLE TO HALFSPACE
-	//DrawLineEx(circle->position, circle->position - projectionDisplacementOntoNormal, 1, GRAY);
-	Vector2 midpoint = circle->position - projectionDisplacementOntoNormal * 0.5f;
-	//DRAW DISTANCE TEXT
-	//DrawText(TextFormat("Dist: %6.0f", dot), midpoint.x, midpoint.y, 30, GRAY); 
+struct replayFrameTiming
+{
+	float updateMilliseconds; // update(), the physics steps and input
+	float frameMilliseconds; // Everything, drawing and the buffer swap included
+	int steps;
+	int bodies;
+};
+vector<replayFrameTiming> replayTimings;
 
-	float overlap = circle->radius - dot;// Sum of radii = 5, distance = 10, overlap = -5 (no overlap)
-	if (overlap > 0) // if overlap is positive, we have collision
+void startSession()
+{
+	if (replayFile)
 	{
-		Vector2 mtv = halfspace->getNormal() * overlap; // minimum translation vector (to move objects out of collision)
-		circle->position += mtv;
-
-		//Get Gravity Force
-		Vector2 Fgravity = world.gravityAcceleration * circle->mass;
-
-		//Apply Normal Force
-		Vector2 FgPerp = halfspace->getNormal() * Vector2DotProduct(Fgravity, halfspace->getNormal());
-		Vector2 Fnormal = FgPerp * -1;
-		circle->netForce += Fnormal;
-
-		DrawLineEx(circle->position, circle->position + Fnormal, 1, GREEN);
-
-		//Friction
-		//F = uN where is coefficient of friction between two surfaces;
-		//F is the max magnitude of force of friction
-		//N is magnitude of normal force.
-		float u = circle->grip * halfspace->grip;
-		float frictionMagnitude = Vector2Length(Fnormal) * u;
+		sessionEvents = LoadAutomationEventList(replayFile);
+		if (sessionEvents.count == 0) TraceLog(LOG_WARNING, "REPLAY: No events in %s", replayFile);
+		world.stepGraph.timing = true;
+	}
+	else if (recordFile)
+	{
+		sessionEvents = LoadAutomationEventList(nullptr);
+		SetAutomationEventList(&sessionEvents);
+		SetAutomationEventBaseFrame(0);
+		StartAutomationEventRecording();
+	}
+}
 
-		//the direction of friction = opposite other applied forces in the surface plane
-		Vector2 FgPara = Fgravity - FgPerp;
-		Vector2 FrictionDirection = Vector2Normalize(FgPara) * -1;
-		//Vector2 Ffriciton = FrictionDirection * frictionMagnitude;
-		// We have to clamp friction to not exceed the force trying to move the object
-		float maxFriction = Vector2Length(FgPara);
-		if (frictionMagnitude > maxFriction) frictionMagnitude = maxFriction;
-		Vector2 Ffriciton = FrictionDirection * frictionMagnitude;
+// Seconds the simulation moves on this frame, fixed while a session is recorded or replayed so it doesn't depend on the frame rate
+float frameSeconds()
+{
+	return (recordFile || replayFile) ? 1.0f / TARGET_FPS : GetFrameTime();
+}
 
-		circle->netForce += Ffriciton;
-		DrawLineEx(circle->position, circle->position + Ffriciton, 2, ORANGE);
-		return true; // Overlapping
+// Play the events recorded on this frame, returns false once the replay has run out
+bool playSessionEvents()
+{
+	if (nextSessionEvent >= sessionEvents.count) return false;
+	while (nextSessionEvent < sessionEvents.count && sessionEvents.events[nextSessionEvent].frame <= sessionFrame) {
+		PlayAutomationEvent(sessionEvents.events[nextSessionEvent]);
+		nextSessionEvent++;
 	}
-	else
-		return false; // Not overlapping
+	return true;
 }
 
-//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//    ________ __________    _____  __      __       /\   ____ _____________________      ___________________________      /\  _________ .____     ___________   _____    _______   ____ _____________ 
-//    \______ \\______   \  /  _  \/  \    /  \     / /  |    |   \______   \______ \    /  _  \__    ___/\_   _____/     / /  \_   ___ \|    |    \_   _____/  /  _  \   \      \ |    |   \______   \
-//     |    |  \|       _/ /  /_\  \   \/\/   /    / /   |    |   /|     ___/|    |  \  /  /_\  \|    |    |    __)_     / /   /    \  \/|    |     |    __)_  /  /_\  \  /   |   \|    |   /|     ___/
-//     |    `   \    |   \/    |    \        /    / /    |    |  / |    |    |    `   \/    |    \    |    |        \   / /    \     \___|    |___  |        \/    |    \/    |    \    |  / |    |    
-//    /_______  /____|_  /\____|__  /\__/\  /    / /     |______/  |____|   /_______  /\____|__  /____|   /_______  /  / /      \______  /_______ \/_______  /\____|__  /\____|__  /______/  |____|    
-//            \/       \/         \/      \/     \/                                 \/         \/                 \/   \/              \/        \/        \/         \/         \/                    
-
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+//       __ _      _    _    ___            _          
+//      / _(_)_ _ (_)__| |_ / __| ___ _____(_)___ _ _  
+//     |  _| | ' \| (_-< ' \\__ \/ -_|_-<_-< / _ \ ' \ 
+//     |_| |_|_||_|_/__/_||_|___/\___/__/__/_\___/_||_|
+//                                                     
+// Save the recording, or report the replay's timings, before the window closes
+/* The replay report goes to the log: frame times (average, percentiles, worst), then every stage of the step with its
+   average time per step. Every frame is also written to <replay>.csv for plotting or diffing two builds */
+void finishSession()
+{
+	if (recordFile)
+	{
+		StopAutomationEventRecording();
+		// An empty event on the last frame that ran (sessionFrame is already one past it), so the replay runs exactly as
+		// many frames as the session did and not just up to the last input
+		// Type 0 is EVENT_NONE, which PlayAutomationEvent skips (the event types are in rcore.c, not raylib.h)
+		if (sessionEvents.count >= sessionEvents.capacity) TraceLog(LOG_WARNING, "RECORD: Event list full, the session was cut short");
+		else if (sessionFrame > 0) sessionEvents.events[sessionEvents.count++] = { (unsigned int)(sessionFrame - 1), 0, { 0, 0, 0, 0 } };
+		if (!ExportAutomationEventList(sessionEvents, recordFile)) TraceLog(LOG_WARNING, "RECORD: Couldn't write %s", recordFile);
+		UnloadAutomationEventList(sessionEvents);
+	}
+	if (!replayFile) return;
+	UnloadAutomationEventList(sessionEvents);
+	if (replayTimings.empty()) return;
 
-	/////////////////////////////////////////////////////////////////////////////////////////////////////////
-	//         _                      __      __       _    _ 
-	//      __| |___ __ _ _ _ _  _ _ _\ \    / /__ _ _| |__| |
-	//     / _| / -_) _` | ' \ || | '_ \ \/\/ / _ \ '_| / _` |
-	//     \__|_\___\__,_|_||_\_,_| .__/\_/\_/\___/_| |_\__,_|
-	//                            |_|                         
-	// Cleanup world by removing objects that are out of bounds
-void cleanupWorld() {
-	for (int i = 0; i < world.objects.size(); i++) {
-		physicObject* obj = world.objects[i];
-		if (obj->position.y > GetScreenHeight()
-			|| obj->position.y < 0
-			|| obj->position.x > GetScreenWidth()
-			|| obj->position.x < 0) {
-			auto iterator = world.objects.begin() + i;
-			physicObject* pointerTopMain = *iterator;
-			delete pointerTopMain; // Free memory
-			world.objects.erase(iterator); // Remove from vector
-			i--; // Adjust index after erasing
-		}
+	string csv = "frame,update_ms,frame_ms,steps,bodies\n";
+	vector<float> frameTimes;
+	double total = 0;
+	int steps = 0;
+	for (int f = 0; f < replayTimings.size(); f++) {
+		replayFrameTiming& timing = replayTimings[f];
+		csv += TextFormat("%i,%.4f,%.4f,%i,%i\n", f, timing.updateMilliseconds, timing.frameMilliseconds, timing.steps, timing.bodies);
+		frameTimes.push_back(timing.frameMilliseconds);
+		total += timing.frameMilliseconds;
+		steps += timing.steps;
 	}
+	const char* csvFile = TextFormat("%s.csv", replayFile);
+	if (!SaveFileText(csvFile, (char*)csv.c_str())) TraceLog(LOG_WARNING, "REPLAY: Couldn't write %s", csvFile);
+
+	sort(frameTimes.begin(), frameTimes.end());
+	auto percentile = [&](float p) { return frameTimes[(int)(p * (frameTimes.size() - 1))]; };
+	TraceLog(LOG_INFO, "REPLAY: %i frames, %i steps in %.1f ms", (int)frameTimes.size(), steps, total);
+	TraceLog(LOG_INFO, "REPLAY: Frame ms: average %.3f | median %.3f | 95%% %.3f | 99%% %.3f | worst %.3f", total / frameTimes.size(),
+		percentile(0.5f), percentile(0.95f), percentile(0.99f), frameTimes.back());
+	world.stepGraph.forEachTiming([&](const char* name, double milliseconds) {
+		TraceLog(LOG_INFO, "REPLAY: Stage %-20s %8.4f ms per step", name, steps > 0 ? milliseconds / steps : 0.0);
+	});
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -428,14 +4531,89 @@ void cleanupWorld() {
 //     | || | '_ \/ _` / _` |  _/ -_)
 //      \_,_| .__/\__,_\__,_|\__\___|
 //          |_|       
-// Update physics world 
+// Update physics world, once per rendered frame
 void update()
 {
-	dt = 1.0f / TARGET_FPS;
-	time += dt;
+	// Playing a state recording back replaces the simulation, frames go by at the rate they were recorded at
+	if (player.playing())
+	{
+		playbackAccumulator += frameSeconds();
+		for (int steps = 0; playbackAccumulator >= 1.0f / player.stepRate && steps < maxStepsPerFrame; steps++) {
+			if (!player.nextFrame())
+			{
+				player.restart(); // Loop
+				if (!player.nextFrame()) break;
+			}
+			playbackAccumulator -= 1.0f / player.stepRate;
+		}
+		if (playbackAccumulator >= 1.0f / player.stepRate) playbackAccumulator = fmodf(playbackAccumulator, 1.0f / player.stepRate);
+		return;
+	}
 
-	cleanupWorld();
-	world.updateObject();
+	// Cycle broadphase, they should all give the same result, brute force just gets slower as objects pile up
+	// Done before the step so the tree is rebuilt before Draw queries it
+	if (IsKeyPressed(KEY_B))
+	{
+		world.broadphase = (BroadphaseMode)((world.broadphase + 1) % 3);
+	}
+	if (IsKeyPressed(KEY_T)) drawBroadphaseTree = !drawBroadphaseTree;
+	// Debug line categories, F switches them all
+	if (IsKeyPressed(KEY_F)) debugDraw.categories = debugDraw.categories ? 0 : DEBUG_ALL;
+	if (IsKeyPressed(KEY_ONE)) debugDraw.categories ^= DEBUG_GRAVITY;
+	if (IsKeyPressed(KEY_TWO)) debugDraw.categories ^= DEBUG_NET_FORCE;
+	if (IsKeyPressed(KEY_THREE)) debugDraw.categories ^= DEBUG_NORMAL;
+	if (IsKeyPressed(KEY_FOUR)) debugDraw.categories ^= DEBUG_FRICTION;
+	if (IsKeyPressed(KEY_N)) world.narrowphaseMode = (world.narrowphaseMode == NARROWPHASE_SIMD) ? NARROWPHASE_SCALAR : NARROWPHASE_SIMD;
+	if (IsKeyPressed(KEY_V)) world.verifySimd = !world.verifySimd;
+	if (IsKeyPressed(KEY_H)) logHashes = !logHashes;
+	if (IsKeyPressed(KEY_P)) world.coloredSolve = !world.coloredSolve;
+	if (IsKeyPressed(KEY_J)) jobs.start(jobs.workerCount() > 0 ? 0 : defaultWorkerCount()); // Switch between single thread and every core
+	if (IsKeyPressed(KEY_I)) world.solver = (SolverMode)((world.solver + 1) % 3); // Position, impulse, substep
+	if (IsKeyPressed(KEY_K)) world.continuousCollision = !world.continuousCollision;
+	if (IsKeyPressed(KEY_S)) world.allowSleep = !world.allowSleep;
+	if (IsKeyPressed(KEY_R)) physicsRate = (physicsRate >= 240) ? 30 : physicsRate * 2; // Cycle 30, 60, 120, 240 Hz
+	if (IsKeyPressed(KEY_F5)) saveWorld(quickSnapshot);
+	if (IsKeyPressed(KEY_F9) && !restoreWorld(quickSnapshot)) TraceLog(LOG_WARNING, "SNAPSHOT: Nothing to restore, save one with F5 first");
+	if (IsKeyPressed(KEY_O))
+	{
+		checkpointing = !checkpointing;
+		nextCheckpoint = simTime; // First one right away
+	}
+	if (IsKeyPressed(KEY_X) && !rewinding)
+	{
+		rewindRecording = !rewindRecording;
+		if (!rewindRecording) history.clear(); // Give the memory back
+	}
+	if (IsKeyPressed(KEY_Z) && (rewinding || !history.empty()))
+	{
+		if (rewinding) history.discardAfterShown(); // Carry on from the frame on screen
+		else rewindTime = shownRewindTime = history.newestTime();
+		rewinding = !rewinding;
+	}
+	if (rewinding)
+	{
+		// Arrow keys go one step at a time, the timeline slider in Draw() moves rewindTime directly
+		if (IsKeyPressed(KEY_LEFT)) rewindTime = history.stepFrom(rewindTime, -1);
+		if (IsKeyPressed(KEY_RIGHT)) rewindTime = history.stepFrom(rewindTime, 1);
+		if (rewindTime != shownRewindTime && history.show(rewindTime)) shownRewindTime = rewindTime;
+	}
+
+	// Run as many fixed steps as fit in the time that has passed, none while rewinding
+	dt = 1.0f / physicsRate;
+	if (!rewinding) accumulator += frameSeconds();
+	stepsThisFrame = 0;
+	while (accumulator >= dt && stepsThisFrame < maxStepsPerFrame && !rewinding)
+	{
+		stepWorld();
+		if (rewindRecording) history.record();
+		if (recorder.recording()) recorder.record();
+		accumulator -= dt;
+		stepsThisFrame++;
+	}
+	// Hit the cap, drop the whole steps we couldn't get to so the next frame doesn't start even further behind (spiral of death)
+	if (accumulator >= dt) accumulator = fmodf(accumulator, dt);
+	alpha = accumulator / dt;
+	checkpointWorld();
 	//if (IsKeyPressed(KEY_SPACE))
 	//{
 	//	physicsCircle* newCircle = new physicsCircle(); // New keyword allocates memory on the heap (as opposed to the stack, where the data will be lost on exisiting scope)
@@ -446,30 +4624,30 @@ void update()
 	//	world.addObject(newCircle);
 	//}
 
-	if (IsKeyPressed(KEY_SPACE))
+	if (IsKeyPressed(KEY_SPACE) && !rewinding) // Not onto a frame from the history, the next show() or Z would lose it
 	{
-		physicsCircle* newCircle = new physicsCircle();
+		physicsCircle* newCircle = circlePool.acquire();
+		world.addObject(newCircle); // Add first, the setters write into the world's body arrays
 
 		// POSITION & VELOCITY
-		newCircle->position = { positionX, GetScreenHeight() - positionY };
-		newCircle->velocity = { (float)cos(angle * DEG2RAD) * speed, (float)-sin(angle * DEG2RAD) * speed };
+		newCircle->setPosition({ positionX, GetScreenHeight() - positionY });
+		newCircle->setVelocity(launchVelocity());
 
 		// RADIUS
-		newCircle->radius = 20;
+		newCircle->setRadius(20);
 		// MASS
-		newCircle->mass = spawnMass;
-		world.addObject(newCircle);
+		newCircle->setMass(spawnMass);
 	}
 
 
-	if (IsKeyDown(KEY_C))
+	if (IsKeyDown(KEY_C) && !rewinding)
 	{
-		physicsCircle* newCircle = new physicsCircle(); // New keyword allocates memory on the heap (as opposed to the stack, where the data will be lost on exisiting scope)
-		newCircle->position = { positionX, GetScreenHeight() - positionY };
-		newCircle->velocity = { (float)cos(angle * DEG2RAD) * speed, (float)-sin(angle * DEG2RAD) * speed };
-		newCircle->radius = (float)(rand() % 20 + 10);
-		//newCircle->color = { static_cast<unsigned char>(rand() % 256),static_cast<unsigned char>(rand() % 256),static_cast<unsigned char>(rand() % 256),255 };
+		physicsCircle* newCircle = circlePool.acquire(); // Recycled slot from the pool instead of a new heap allocation every frame
 		world.addObject(newCircle);
+		newCircle->setPosition({ positionX, GetScreenHeight() - positionY });
+		newCircle->setVelocity(launchVelocity());
+		newCircle->setRadius((float)(world.randomInt(20) + 10));
+		//newCircle->color = { static_cast<unsigned char>(rand() % 256),static_cast<unsigned char>(rand() % 256),static_cast<unsigned char>(rand() % 256),255 };
 	}
 }
 
@@ -487,6 +4665,37 @@ void Draw()
 	ClearBackground(BLACK);
 	DrawText("Rhieyanne Fajardo: 101554981", 10, GetScreenHeight() - 20 - 10, 20, WHITE);
 	DrawText(TextFormat("FPS: %02i", GetFPS()), 10, 10, 20, LIME);
+	const char* broadphaseNames[] = { "Brute force", "Grid", "AABB tree" };
+	DrawText(TextFormat("Broadphase [B]: %s | Objects: %i | Pair tests: %i | Contacts: %i", broadphaseNames[world.broadphase],
+		(int)world.objects.size(), world.pairTests, world.contactCount), 130, 10, 20, LIME);
+	DrawText(TextFormat("Narrowphase [N]: %s | Verify SIMD [V]: %s | Step hash [H]: %s", (world.narrowphaseMode == NARROWPHASE_SIMD) ? NARROWPHASE_SIMD_NAME : "Scalar",
+		world.verifySimd ? TextFormat("%i mismatches", world.narrowphaseMismatches.load()) : "off", stepHash ? TextFormat("%08X", stepHash) : "off"), 1000, 10, 20, LIME);
+	DrawText(TextFormat("Workers [J]: %i | Colored solve [P]: %s | Solver [I]: %s", jobs.workerCount(),
+		world.coloredSolve ? TextFormat("%i colors", world.colorCount) : "off",
+		world.usingImpulses() ? TextFormat("impulse, %i iterations", world.solverIterations)
+		: world.usingSubsteps() ? TextFormat("XPBD, %i substeps", world.substeps) : "position"), 1000, 35, 20, LIME);
+	DrawText(TextFormat("Physics [R]: %i Hz | Steps this frame: %i | Step time: %.2f ms | Checkpoints [O]: %s", (int)physicsRate, stepsThisFrame,
+		stepMilliseconds, checkpointing ? TextFormat("%i written, %.2f ms", checkpointsWritten, checkpointMilliseconds) : "off"), 1000, 60, 20, LIME);
+	unsigned int shown = debugDraw.categories;
+	DrawText(TextFormat("Debug lines [F]: gravity [1] %s | net force [2] %s | normal [3] %s | friction [4] %s",
+		(shown & DEBUG_GRAVITY) ? "on" : "off", (shown & DEBUG_NET_FORCE) ? "on" : "off", (shown & DEBUG_NORMAL) ? "on" : "off",
+		(shown & DEBUG_FRICTION) ? "on" : "off"), 1000, 85, 20, LIME);
+	DrawText(TextFormat("Circle pool: %i live | %i free | %i high water | %i capacity", circlePool.liveCount(), circlePool.freeCount(),
+		circlePool.highWaterMark(), circlePool.capacity()), 1000, 110, 20, LIME);
+	DrawText(TextFormat("Sleeping [S]: %s | Continuous collision [K]: %s | Rewind [X, Z]: %s", world.allowSleep ? TextFormat("%i bodies", world.sleepingCount) : "off",
+		world.continuousCollision ? TextFormat("%i swept", world.sweptCount) : "off", rewindRecording ? TextFormat("%.1f s, %i of %i MB",
+		history.newestTime() - history.oldestTime(), (int)(history.bytes() >> 20), (int)(history.budget >> 20)) : "off"), 1000, 135, 20, LIME);
+	DrawText(TextFormat("Contact cache: %i contacts | %i persistent | Snapshot [F5 save, F9 restore]: %i bytes", (int)world.contactCache.size(),
+		world.persistentContacts, (int)quickSnapshot.size()), 1000, 160, 20, LIME);
+	if (recorder.recording())
+	{
+		DrawText(TextFormat("Recording states: %i frames | %.2f MB | %.2f ms per step", recorder.frames(), recorder.bytes() / (1024.0f * 1024.0f),
+			recorder.frameMilliseconds()), 10, GetScreenHeight() - 55, 20, RED);
+	}
+	if (player.playing())
+	{
+		DrawText(TextFormat("Playing states: frame %i | %.2f s | %i bodies", player.frame, player.frameTime, (int)player.radius.size()), 10, GetScreenHeight() - 55, 20, ORANGE);
+	}
 
 	// [STEP 2: ADJUST AND CONFIGURE]
 
@@ -500,8 +4709,10 @@ void Draw()
 	GuiSliderBar(Rectangle{ 10, 140, 200, 20 }, "", TextFormat("Gravity Acceleration: %.0f", world.gravityAcceleration.y), &world.gravityAcceleration.y, -300, 300);
 
 	// Controls for halfspace
-	GuiSliderBar(Rectangle{ 80, 160, 240, 20 }, "HalfspaceX", TextFormat("%.0f", halfspace.position.x), &halfspace.position.x, 0, GetScreenWidth());
-	GuiSliderBar(Rectangle{ 380, 160, 240, 20 }, "HalfspaceY", TextFormat("%.0f", halfspace.position.y), &halfspace.position.y, 0, GetScreenHeight());
+	Vector2 halfspacePosition = halfspace.getPosition(); // Position lives in the body arrays, so slide a copy and write it back
+	GuiSliderBar(Rectangle{ 80, 160, 240, 20 }, "HalfspaceX", TextFormat("%.0f", halfspacePosition.x), &halfspacePosition.x, 0, GetScreenWidth());
+	GuiSliderBar(Rectangle{ 380, 160, 240, 20 }, "HalfspaceY", TextFormat("%.0f", halfspacePosition.y), &halfspacePosition.y, 0, GetScreenHeight());
+	halfspace.setPosition(halfspacePosition);
 	float halfspaceRotation = halfspace.getRotation();
 	GuiSliderBar(Rectangle{ 780, 160, 100, 20 }, "Halfspace Rotation", TextFormat("%.0f", halfspace.getRotation()), &halfspaceRotation, -180, 180);
 	halfspace.setRotation(halfspaceRotation);
@@ -509,14 +4720,23 @@ void Draw()
 	// Control for Friction
 	//GuiSliderBar(Rectangle{ 1100, 160, 200, 20 }, "Coefficient of Friction", TextFormat("%.2f", coefficientofFriction), &coefficientofFriction, 0.0f, 1.0f);
 	GuiSliderBar(Rectangle{ 1100, 190, 200, 20 }, "Mass", TextFormat("%.2f", spawnMass), &spawnMass, 0.1f, 10.0f);
-	GuiSliderBar(Rectangle{ 1100, 220, 200, 20 }, "Grip | slippery-grippy", TextFormat("%.2f", halfspace.grip), &halfspace.grip, 0.0f, 1.0f);
+	float halfspaceGrip = halfspace.getGrip();
+	GuiSliderBar(Rectangle{ 1100, 220, 200, 20 }, "Grip | slippery-grippy", TextFormat("%.2f", halfspaceGrip), &halfspaceGrip, 0.0f, 1.0f);
+	halfspace.setGrip(halfspaceGrip);
+
+	// Timeline for scrubbing through recorded steps, update() puts the world back to wherever it points
+	if (rewinding)
+	{
+		GuiSliderBar(Rectangle{ 420, (float)GetScreenHeight() - 35, 800, 20 }, "Rewind [Z, arrows]", TextFormat("%.2f s", rewindTime - history.newestTime()),
+			&rewindTime, history.oldestTime(), history.newestTime());
+	}
 
 	
 
 	// [STEP 3: SIMULATION AND DRAWING BALL AND LINE]
 	// Drawing the Line
 	Vector2 startPos = { positionX, GetScreenHeight() - positionY };
-	Vector2 velocity = { (float)cos(angle * DEG2RAD) * speed, (float)-sin(angle * DEG2RAD) * speed };
+	Vector2 velocity = launchVelocity();
 	DrawLineEx(startPos, startPos + velocity, 3, RED);
 
 	// Drawing all objects in the world with their own draw function
@@ -524,14 +4744,47 @@ void Draw()
 	   Then we call the parent function draw(), we should get the derived class behavior specific to what the object actually is.
 	   Example, physicsCircle.draw() should call the Circle draw function, physicsHalfspace.draw() should call the halfspace draw function
 	*/
-	for (int i = 0; i < world.objects.size(); i++)
+	debugDraw.flush(); // Force vectors from the last physics step, under the objects
+
+	if (player.playing())
+	{
+		// Recorded circles, colored from blue when still to red when fast
+		for (int i = 0; i < player.radius.size(); i++) {
+			if (player.radius[i] <= 0) continue; // Halfspaces, the real one is drawn below
+			float speed = Vector2Length({ player.velocityX[i], player.velocityY[i] });
+			DrawCircleV({ player.positionX[i], player.positionY[i] }, player.radius[i], ColorFromHSV(240.0f - fminf(speed / 600.0f, 1.0f) * 240.0f, 0.8f, 1.0f));
+		}
+	}
+	else
 	{
-		physicObject* obj = world.objects[i];
-		obj->draw();
+		for (int i = 0; i < world.objects.size(); i++)
+		{
+			physicObject* obj = world.objects[i];
+			obj->draw();
+		}
 	}
 
 	halfspace.draw();
 
+	// Scene queries through the broadphase tree, highlight the circle under the mouse and where the launch line first hits something
+	if (world.broadphase == BROADPHASE_TREE)
+	{
+		physicObject* hovered = world.queryPoint(GetMousePosition());
+		if (hovered != nullptr) DrawCircleLinesV(hovered->getDrawPosition(), ((physicsCircle*)hovered)->getRadius() + 3, WHITE);
+
+		Vector2 hitPoint;
+		if (world.rayCast(startPos, startPos + velocity, &hitPoint) != nullptr) DrawCircleV(hitPoint, 5, YELLOW);
+
+		if (drawBroadphaseTree)
+		{
+			for (auto& node : world.tree.nodes) {
+				if (node.height < 0) continue; // On the free list
+				Color color = (node.left == -1) ? SKYBLUE : Fade(DARKBLUE, 0.6f);
+				DrawRectangleLinesEx({ node.box.min.x, node.box.min.y, node.box.max.x - node.box.min.x, node.box.max.y - node.box.min.y }, 1, color);
+			}
+		}
+	}
+
 	// Old Drawing Functions
 	/* void DrawCircleV(Vector2 center, float radius, Color color); // Draw a color-filled circle (Vector version)
 		for (auto& ball : sim.balls) {
@@ -569,12 +4822,28 @@ void Draw()
 //    \____|__  (____  /__|___|  /  \___  / |____/|___|  /\___  >__| |__|\____/|___|  /
 //            \/     \/        \/       \/             \/     \/                    \/ 
 	// Main Function
-int main() {
+int main(int argc, char* argv[]) {
+	for (int i = 1; i + 1 < argc; i++) {
+		if (strcmp(argv[i], "--record") == 0) recordFile = argv[++i];
+		else if (strcmp(argv[i], "--replay") == 0) replayFile = argv[++i];
+		else if (strcmp(argv[i], "--hashes") == 0) hashFile = argv[++i];
+		else if (strcmp(argv[i], "--compare-hashes") == 0) compareFile = argv[++i];
+		else if (strcmp(argv[i], "--record-states") == 0) stateRecordFile = argv[++i];
+		else if (strcmp(argv[i], "--play-states") == 0) statePlayFile = argv[++i];
+	}
 	InitWindow(InitialWidth, InitialHeight, "Rhieyanne-Fajardo-101554981");
-	SetTargetFPS(TARGET_FPS);
-	halfspace.position = { 500, 900 };
-	halfspace.isStatic = true;
-	world.addObject(&halfspace); // Add halfspace to simulation for drawing only
+	SetTargetFPS(replayFile ? 0 : TARGET_FPS); // Replays run as fast as they can, there's no vsync unless FLAG_VSYNC_HINT is set
+	jobs.start(workerThreads < 0 ? defaultWorkerCount() : workerThreads);
+	world.addObject(&halfspace, true); // Add halfspace to simulation, it's a global so the world doesn't own it
+	halfspace.setPosition({ 500, 900 });
+	halfspace.setStatic(true);
+	// Sessions, hash logs and state recordings have to start from the same clean world every time, not whatever checkpoint is left on disk
+	bool capturing = recordFile || replayFile || hashFile || compareFile || stateRecordFile || statePlayFile;
+	if (resumeFromCheckpoint && !capturing) resumeCheckpoint(); // After the halfspace is added, the checkpoint expects to find it
+	startSession();
+	openHashFiles();
+	if (stateRecordFile && !recorder.start(stateRecordFile)) TraceLog(LOG_WARNING, "STATES: Couldn't create %s", stateRecordFile);
+	if (statePlayFile && !player.open(statePlayFile)) TraceLog(LOG_WARNING, "STATES: %s isn't a state recording", statePlayFile);
 
 	//halfspace2.isStatic = true;
 	//halfspace2.position = { 600, 900 };
@@ -582,9 +4851,22 @@ int main() {
 	//sim.addObject(&halfspace2);
 
 	while (!WindowShouldClose()) {
+		if (replayFile && !playSessionEvents()) break;
+		double frameStart = GetTime();
 		update();
+		double updateEnd = GetTime();
 		Draw();
+		if (replayFile) replayTimings.push_back({ (float)((updateEnd - frameStart) * 1000.0), (float)((GetTime() - frameStart) * 1000.0), stepsThisFrame, (int)world.objects.size() });
+		sessionFrame++;
 	}
+	finishSession();
+	closeHashFiles();
+	recorder.stop();
+	player.close();
+#if defined(PHYSICS_FORK_CHECKPOINTS)
+	if (checkpointWriter != 0) waitpid(checkpointWriter, nullptr, 0); // Let the last checkpoint finish writing
+#endif
+	jobs.stop();
 	CloseWindow();
 	return 0;
 }